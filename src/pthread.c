@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <process.h>
 #include <assert.h>
 
@@ -31,8 +32,172 @@
 
 __declspec(thread) slim_pthread_t self = NULL;
 
+// Descriptor of a thread not created by pthread_create(), set up by its
+// first pthread_self(). Lives as long as the thread, so only its thread
+// handle is left over when no cleanup runs for it.
+static __declspec(thread) struct opaque_pthread_t foreign;
+
+#ifndef SLIM_PTHREAD_DYNAMIC
+// Pulls the TLS callback of dllmain.c into images linking the static
+// library, so that thread exit cleanup runs without a DllMain.
+#ifdef _WIN64
+#pragma comment(linker, "/INCLUDE:slim_pthread_tls_callback")
+#else
+#pragma comment(linker, "/INCLUDE:_slim_pthread_tls_callback")
+#endif
+#endif
+
+// Mirrors self for the inline functions in pthread.h, which cannot reach
+// a __declspec(thread) variable across the DLL boundary.
+DWORD __slim_pthread_self_slot = TLS_OUT_OF_INDEXES;
+static INIT_ONCE self_slot_once = INIT_ONCE_STATIC_INIT;
+
+static
+BOOL CALLBACK self_slot_setup(PINIT_ONCE InitOnce, PVOID Parameter, PVOID *lpContext)
+{
+    __slim_pthread_self_slot = TlsAlloc();
+    return __slim_pthread_self_slot != TLS_OUT_OF_INDEXES;
+}
+
+bool slim_pthread_self_slot_init(void)
+{
+    return InitOnceExecuteOnce(&self_slot_once, self_slot_setup,
+            NULL, NULL) == TRUE;
+}
+
+void slim_pthread_set_self(slim_pthread_t thread)
+{
+    self = thread;
+
+    if (slim_pthread_self_slot_init())
+        TlsSetValue(__slim_pthread_self_slot, (LPVOID)thread);
+}
+
+static bool sched_range(int policy, int *min, int *max)
+{
+    switch (policy & (~SCHED_RESET_ON_FORK)) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        *min = __SLIM_SCHED_RT_PRIORITY_MIN;
+        *max = __SLIM_SCHED_RT_PRIORITY_MAX;
+        return true;
+
+    case SCHED_OTHER:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        *min = 0;
+        *max = 0;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static bool sched_valid(int policy, int priority)
+{
+    int min, max;
+
+    return sched_range(policy, &min, &max) &&
+            priority >= min && priority <= max;
+}
+
+// Windows thread priority level for a valid policy and priority.
+static int sched_level(int policy, int priority)
+{
+    switch (policy & (~SCHED_RESET_ON_FORK)) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        if (priority >= 99)
+            return THREAD_PRIORITY_TIME_CRITICAL;
+        if (priority >= 50)
+            return THREAD_PRIORITY_HIGHEST;
+        return THREAD_PRIORITY_ABOVE_NORMAL;
+
+    case SCHED_BATCH:
+        return THREAD_PRIORITY_BELOW_NORMAL;
+
+    case SCHED_IDLE:
+        return THREAD_PRIORITY_IDLE;
+
+    default:
+        return THREAD_PRIORITY_NORMAL;
+    }
+}
+
+int sched_get_priority_min(int policy)
+{
+    int min, max;
+
+    if (!sched_range(policy, &min, &max)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return min;
+}
+
+int sched_get_priority_max(int policy)
+{
+    int min, max;
+
+    if (!sched_range(policy, &min, &max)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return max;
+}
+
+// Handle for acting on a thread, NULL if there is none. Foreign threads
+// have none when duplicating their handle failed.
+HANDLE slim_pthread_handle(slim_pthread_t thread)
+{
+    if (thread == self)
+        return GetCurrentThread();
+
+    return thread->handle;
+}
+
+// The cache worker running on this thread, if any, see cache_park().
+static __declspec(thread) slim_pthread_worker_t *current_worker = NULL;
+
+// Releases a descriptor. Batch descriptors share one allocation, which
+// goes with the last of them.
+void slim_pthread_free(slim_pthread_t thread)
+{
+    slim_pthread_batch_t *batch = thread->batch;
+
+    memset(thread, 0, sizeof(struct _slim_pthread_t));
+
+    if (!batch)
+        free(thread);
+    else if (InterlockedDecrement(&batch->refs) == 0)
+        _aligned_free(batch);
+}
+
+// The creator stores the handle once _beginthreadex() returns, which may
+// be after the thread is done.
+static HANDLE thread_handle(slim_pthread_t thread)
+{
+    HANDLE none = NULL;
+
+    while (!thread->handle)
+        WaitOnAddress(&thread->handle, &none, sizeof(none), INFINITE);
+
+    return thread->handle;
+}
+
 void slim_pthread_cleanup(void)
 {
+    HANDLE handle;
+
+    // Foreign threads may have entered RCU read sections too. Fibers
+    // share the reader record of their carrier, where other fibers may
+    // still be inside a read section, so it goes with the OS thread only.
+    if (!self || !self->fiber)
+        slim_pthread_rcu_cleanup();
+
     if (!self)
         return;
 
@@ -43,68 +208,400 @@ void slim_pthread_cleanup(void)
         self->cleanup_stack = self->cleanup_stack->__next;
     }
 
-    slim_pthread_keys_cleanup();
+    slim_pthread_keys_cleanup(self);
 
     self->normal_exit = 1;
 
-    if (self->detached) {
-        memset(self, 0, sizeof(struct _slim_pthread_t));
-        free(self);
+    if (self == (slim_pthread_t)&foreign) {
+        // Static storage, see __slim_pthread_self().
+        if (self->handle)
+            CloseHandle(self->handle);
+        memset(&foreign, 0, sizeof(foreign));
+    } else if (!self->fiber && !slim_pthread_mark_exited(self)) {
+        // Process scope threads are released by their carrier once off
+        // their stack, see slim_pthread_fiber_exit(), and joinable ones by
+        // their joiner. Cached threads borrow the handle of their worker.
+        handle = thread_handle(self);
+        if (!(current_worker && handle == current_worker->handle))
+            CloseHandle(handle);
+
+        slim_pthread_free(self);
     }
 
-    self = NULL;
+    slim_pthread_set_self(NULL);
 }
 
-static unsigned int __stdcall pthread_start_routine(void *arg)
+/*
+ * Thread cache, see pthread_setcacheparams_np(). Idle workers form a LIFO
+ * list so that the most recently used, cache warm, thread runs next.
+ */
+#define WORKER_EXIT                     ((slim_pthread_t)(intptr_t)-1)
+
+static SRWLOCK cache_lock = SRWLOCK_INIT;
+static slim_pthread_worker_t *cache_idle = NULL;
+static unsigned int cache_count = 0;
+static volatile unsigned int cache_max = 0;
+static unsigned int cache_idle_ms = 0;
+
+static void cache_unlink(slim_pthread_worker_t *worker)
 {
-    self = (slim_pthread_t)arg;
-    assert(self && self->sig == _PTHREAD_INIT);
+    slim_pthread_worker_t **prev;
 
-    self->exit_value_ptr = self->start_routine(self->start_arg);
+    for (prev = &cache_idle; *prev; prev = &(*prev)->next) {
+        if (*prev == worker) {
+            *prev = worker->next;
+            cache_count--;
+            return;
+        }
+    }
+}
+
+// Hands the worker its next descriptor. Called with cache_lock held, so a
+// worker timing out cannot miss it.
+static void cache_handoff(slim_pthread_worker_t *worker, slim_pthread_t thread)
+{
+    cache_unlink(worker);
+    InterlockedExchangePointer((PVOID volatile *)&worker->thread,
+            (PVOID)thread);
+    WakeByAddressSingle((PVOID)&worker->thread);
+}
+
+// Parks the calling worker until pthread_create() hands it a descriptor.
+// Returns NULL when the worker should exit instead.
+static slim_pthread_t cache_park(slim_pthread_worker_t *worker)
+{
+    slim_pthread_t none = NULL;
+    ULONGLONG deadline, now;
+
+    if (!cache_max)
+        return NULL;
+
+    // The handle from _beginthreadex belongs to the first descriptor.
+    if (!worker->handle && !DuplicateHandle(GetCurrentProcess(),
+            GetCurrentThread(), GetCurrentProcess(), &worker->handle,
+            0, FALSE, DUPLICATE_SAME_ACCESS))
+        return NULL;
+
+    // Look fresh to the next start routine.
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+
+    AcquireSRWLockExclusive(&cache_lock);
+    if (cache_count >= cache_max) {
+        ReleaseSRWLockExclusive(&cache_lock);
+        return NULL;
+    }
+
+    worker->thread = NULL;
+    worker->next = cache_idle;
+    cache_idle = worker;
+    cache_count++;
+    deadline = GetTickCount64() + cache_idle_ms;
+    ReleaseSRWLockExclusive(&cache_lock);
+
+    while (!worker->thread) {
+        now = GetTickCount64();
+        if (now >= deadline) {
+            AcquireSRWLockExclusive(&cache_lock);
+            if (!worker->thread)
+                cache_unlink(worker);
+            ReleaseSRWLockExclusive(&cache_lock);
+            break;
+        }
+
+        WaitOnAddress(&worker->thread, &none, sizeof(none),
+                (DWORD)(deadline - now));
+    }
+
+    if (worker->thread == WORKER_EXIT)
+        return NULL;
+
+    return worker->thread;
+}
+
+// Runs the new descriptor on an idle worker with the same stack.
+static bool cache_claim(slim_pthread_t thread)
+{
+    slim_pthread_worker_t *worker;
+
+    AcquireSRWLockExclusive(&cache_lock);
+    for (worker = cache_idle; worker; worker = worker->next) {
+        if (worker->stacksize == thread->stacksize &&
+                worker->guardsize == thread->guardsize &&
+                worker->stackpolicy == thread->stackpolicy)
+            break;
+    }
+
+    if (worker) {
+        thread->handle = worker->handle;
+        thread->id = worker->id;
+
+        // Parked workers run at normal priority.
+        if (sched_level(thread->schedpolicy, thread->schedpriority) !=
+                THREAD_PRIORITY_NORMAL)
+            SetThreadPriority(worker->handle,
+                    sched_level(thread->schedpolicy, thread->schedpriority));
+
+        cache_handoff(worker, thread);
+    }
+    ReleaseSRWLockExclusive(&cache_lock);
+
+    return worker != NULL;
+}
+
+int pthread_setcacheparams_np(unsigned int max_threads, unsigned int idle_ms)
+{
+    AcquireSRWLockExclusive(&cache_lock);
+    cache_max = max_threads;
+    cache_idle_ms = idle_ms;
+
+    while (cache_count > cache_max)
+        cache_handoff(cache_idle, WORKER_EXIT);
+    ReleaseSRWLockExclusive(&cache_lock);
 
-    slim_pthread_cleanup();
     return 0;
 }
 
-int pthread_create(pthread_t *__thread, const pthread_attr_t *__attr,
-        void *(*start_routine)(void *), void *arg)
+int pthread_getcacheparams_np(unsigned int *max_threads, unsigned int *idle_ms)
 {
-    slim_pthread_attr_t attr;
-    slim_pthread_t thread;
-    unsigned int stacksize;
+    if (!max_threads || !idle_ms)
+        return EINVAL;
 
-    if (!__thread || !start_routine)
+    AcquireSRWLockShared(&cache_lock);
+    *max_threads = cache_max;
+    *idle_ms = cache_idle_ms;
+    ReleaseSRWLockShared(&cache_lock);
+
+    return 0;
+}
+
+// Value of setup while a new thread still prepares its stack.
+#define SETUP_PENDING                   (-1)
+
+// Turns the guardsize bytes at the end of the stack reservation into a
+// real guard region. Windows itself only keeps one guard page below the
+// committed part of the stack, which moves down as the stack grows.
+static int stack_guard_apply(size_t guardsize)
+{
+    ULONG_PTR low, high, room;
+    SYSTEM_INFO info;
+    DWORD protect;
+    size_t size;
+
+    GetSystemInfo(&info);
+    size = (guardsize + info.dwPageSize - 1) &
+            ~(size_t)(info.dwPageSize - 1);
+
+    // Keep clear of the frames in use, with a page to spare.
+    GetCurrentThreadStackLimits(&low, &high);
+    room = (ULONG_PTR)&protect - low;
+    if (room < info.dwPageSize || size > room - info.dwPageSize)
         return EINVAL;
 
+    // Reserved pages cannot be protected, commit them first.
+    if (!VirtualAlloc((LPVOID)low, size, MEM_COMMIT, PAGE_NOACCESS) ||
+            !VirtualProtect((LPVOID)low, size, PAGE_NOACCESS, &protect))
+        return ENOMEM;
+
+    return 0;
+}
+
+static unsigned int __stdcall pthread_start_routine(void *arg)
+{
+    slim_pthread_worker_t worker = {NULL, NULL, 0, 0, 0, 0, NULL};
+    slim_pthread_t thread = (slim_pthread_t)arg;
+    bool detached;
+
+    // pthread_create() failed to set the thread up and waits for it.
+    if (!thread->start_routine)
+        return 0;
+
+    worker.id = GetCurrentThreadId();
+    thread->id = worker.id;
+    worker.stacksize = thread->stacksize;
+    worker.guardsize = thread->guardsize;
+    worker.stackpolicy = thread->stackpolicy;
+    current_worker = &worker;
+
+    // pthread_create() waits for the outcome, and owns the descriptor
+    // again once it sees a failure.
+    if (thread->guardsize) {
+        long rc = stack_guard_apply(thread->guardsize);
+
+        InterlockedExchange(&thread->setup, rc);
+        WakeByAddressSingle((PVOID)&thread->setup);
+        if (rc != 0)
+            return 0;
+    }
+
+    do {
+        slim_pthread_set_self(thread);
+        assert(self && self->sig == _PTHREAD_INIT);
+
+        if (slim_pthread_batch_wait(self))
+            self->exit_value_ptr = self->start_routine(self->start_arg);
+
+        // Only detached threads park, and only with the default affinity.
+        // Joiners close the handle once the descriptor is exited.
+        detached = self->joinstate == THREAD_DETACHED && !self->affinity;
+        slim_pthread_cleanup();
+    } while (detached && (thread = cache_park(&worker)) != NULL);
+
+    if (worker.handle)
+        CloseHandle(worker.handle);
+
+    return 0;
+}
+
+// Copies the attributes of a new thread, the defaults for NULL.
+static int attr_prepare(const pthread_attr_t *__attr, slim_pthread_attr_t *attr)
+{
     if (__attr && __attr->__sig != _PTHREAD_ATTR_INIT)
         return EINVAL;
 
-    thread = (slim_pthread_t)calloc(1, sizeof(struct opaque_pthread_t));
-    if (!thread)
-        return EAGAIN;
-
     if (__attr)
-        attr = *(slim_pthread_attr_t *)__attr;
+        *attr = *(slim_pthread_attr_t *)__attr;
     else
-        pthread_attr_init((pthread_attr_t *)&attr);
+        pthread_attr_init((pthread_attr_t *)attr);
+
+    // The policy and priority can be set in either order, so they are
+    // only checked against each other here.
+    if (attr->inheritsched == PTHREAD_EXPLICIT_SCHED &&
+            !sched_valid(attr->schedpolicy, attr->schedpriority))
+        return EINVAL;
+
+    return 0;
+}
+
+// Fills in a zeroed descriptor and starts its thread. The caller still
+// owns the descriptor when this fails.
+static int thread_start(slim_pthread_t thread, const slim_pthread_attr_t *attr,
+        void *(*start_routine)(void *), void *arg)
+{
+    unsigned int stacksize, flags, id;
+    HANDLE handle;
+    int level;
 
     thread->sig = _PTHREAD_INIT;
-    thread->detached = (attr.detachstate == PTHREAD_CREATE_DETACHED);
+    thread->joinstate = attr->detachstate == PTHREAD_CREATE_DETACHED ?
+            THREAD_DETACHED : THREAD_JOINABLE;
     thread->cancelstate = PTHREAD_CANCEL_ENABLE;
     thread->canceltype = PTHREAD_CANCEL_DEFERRED;
-    thread->schedpolicy = attr.schedpolicy;
-    thread->schedpriority = attr.schedpriority;
+    if (attr->inheritsched == PTHREAD_EXPLICIT_SCHED) {
+        thread->schedpolicy = attr->schedpolicy;
+        thread->schedpriority = attr->schedpriority;
+    } else if (self) {
+        thread->schedpolicy = self->schedpolicy;
+        thread->schedpriority = self->schedpriority;
+    } else {
+        thread->schedpolicy = SCHED_OTHER;
+        thread->schedpriority = 0;
+    }
     thread->start_routine = start_routine;
     thread->start_arg = arg;
+    thread->stacksize = attr->stacksize;
+    thread->guardsize = attr->guardsize;
+    thread->stackpolicy = attr->stackpolicy;
+    thread->affinity = attr->has_cpuset ||
+            slim_pthread_numa_placed(attr->numanode);
+
+    if (attr->contentionscope == PTHREAD_SCOPE_PROCESS)
+        return slim_pthread_fiber_create(thread);
+
+    if (thread->joinstate == THREAD_DETACHED && !thread->affinity &&
+            cache_max &&
+            cache_claim(thread))
+        return 0;
+
+    stacksize = (unsigned int)attr->stacksize;
 
-    stacksize = (unsigned int)attr.stacksize;
+    // Without the reservation flag the stack size is also committed.
+    flags = attr->stackpolicy == PTHREAD_STACK_RESERVE_NP ?
+            STACK_SIZE_PARAM_IS_A_RESERVATION : 0;
 
-    thread->handle = (HANDLE)_beginthreadex(NULL, stacksize,
-            pthread_start_routine, (void *)thread, 0, &thread->id);
-    if (thread->handle == (HANDLE)(-1L)) {
-        int rc = errno;
-        memset((void *)thread, 0, sizeof(struct _slim_pthread_t));
-        free((void *)thread);
+    // Settings that must hold before the start routine runs are applied
+    // while the thread is suspended.
+    level = sched_level(thread->schedpolicy, thread->schedpriority);
+    if (thread->affinity || level != THREAD_PRIORITY_NORMAL)
+        flags |= CREATE_SUSPENDED;
+
+    thread->setup = thread->guardsize ? SETUP_PENDING : 0;
+
+    handle = (HANDLE)_beginthreadex(NULL, stacksize,
+            pthread_start_routine, (void *)thread, flags, &id);
+    if (!handle)
+        return errno;
+
+    if (flags & CREATE_SUSPENDED) {
+        int rc = 0;
+
+        if (attr->has_cpuset)
+            rc = slim_pthread_affinity_apply(handle, &attr->cpuset);
+        else if (slim_pthread_numa_placed(attr->numanode))
+            rc = slim_pthread_numa_apply(handle, attr->numanode);
+
+        if (rc == 0 && level != THREAD_PRIORITY_NORMAL &&
+                !SetThreadPriority(handle, level))
+            rc = EPERM;
+
+        if (rc != 0)
+            thread->start_routine = NULL;
+
+        ResumeThread(handle);
+
+        if (rc != 0) {
+            WaitForSingleObject(handle, INFINITE);
+            CloseHandle(handle);
+            return rc;
+        }
+    }
+
+    if (thread->guardsize) {
+        long pending = SETUP_PENDING;
+        int rc;
+
+        while (thread->setup == SETUP_PENDING)
+            WaitOnAddress(&thread->setup, &pending, sizeof(pending),
+                    INFINITE);
+
+        rc = (int)thread->setup;
+        if (rc != 0) {
+            WaitForSingleObject(handle, INFINITE);
+            CloseHandle(handle);
+            return rc;
+        }
+    }
+
+    // The thread may be done already, and a detached one waits for its
+    // handle to close it before freeing the descriptor, so this is the
+    // last access to it.
+    thread->id = id;
+    InterlockedExchangePointer((PVOID volatile *)&thread->handle,
+            (PVOID)handle);
+    WakeByAddressSingle((PVOID)&thread->handle);
+    return 0;
+}
+
+int pthread_create(pthread_t *__thread, const pthread_attr_t *__attr,
+        void *(*start_routine)(void *), void *arg)
+{
+    slim_pthread_attr_t attr;
+    slim_pthread_t thread;
+    int rc;
+
+    if (!__thread || !start_routine)
+        return EINVAL;
+
+    rc = attr_prepare(__attr, &attr);
+    if (rc != 0)
+        return rc;
+
+    thread = (slim_pthread_t)calloc(1, sizeof(struct opaque_pthread_t));
+    if (!thread)
+        return EAGAIN;
+
+    rc = thread_start(thread, &attr, start_routine, arg);
+    if (rc != 0) {
+        slim_pthread_free(thread);
         return rc;
     }
 
@@ -112,6 +609,113 @@ int pthread_create(pthread_t *__thread, const pthread_attr_t *__attr,
     return 0;
 }
 
+/*
+ * Batch descriptors follow a header slot in one cache line aligned
+ * allocation, each padded to whole cache lines so neighbouring threads do
+ * not share lines.
+ */
+#define BATCH_ALIGN     64
+#define BATCH_STRIDE    ((sizeof(struct opaque_pthread_t) + BATCH_ALIGN - 1) \
+        & ~(size_t)(BATCH_ALIGN - 1))
+
+static slim_pthread_t batch_thread(slim_pthread_batch_t *batch,
+        unsigned int index)
+{
+    return (slim_pthread_t)((char *)batch + (index + 1) * BATCH_STRIDE);
+}
+
+// Holds a thread of a synchronized batch until the whole batch exists.
+// Returns false when the batch was abandoned instead.
+bool slim_pthread_batch_wait(slim_pthread_t thread)
+{
+    slim_pthread_batch_t *batch = thread->batch;
+    long waiting = BATCH_WAIT;
+
+    if (!batch)
+        return true;
+
+    while (batch->start == BATCH_WAIT)
+        slim_pthread_wait(&batch->start, &waiting, sizeof(waiting), INFINITE);
+
+    return batch->start == BATCH_GO;
+}
+
+int pthread_create_batch_np(pthread_t *threads, const pthread_attr_t *__attr,
+        const pthread_start_np *starts, unsigned int count, int flags)
+{
+    slim_pthread_attr_t attr;
+    slim_pthread_batch_t *batch;
+    unsigned int i, created;
+    int rc;
+
+    if (!threads || !starts || !count ||
+            (flags & ~PTHREAD_CREATE_BATCH_SYNC_NP))
+        return EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if (!starts[i].start_routine)
+            return EINVAL;
+    }
+
+    rc = attr_prepare(__attr, &attr);
+    if (rc != 0)
+        return rc;
+
+    if (count >= SIZE_MAX / BATCH_STRIDE)
+        return EAGAIN;
+
+    batch = (slim_pthread_batch_t *)_aligned_malloc(
+            (count + 1) * BATCH_STRIDE, BATCH_ALIGN);
+    if (!batch)
+        return EAGAIN;
+
+    memset(batch, 0, (count + 1) * BATCH_STRIDE);
+
+    batch->refs = count;
+    batch->start = (flags & PTHREAD_CREATE_BATCH_SYNC_NP) ?
+            BATCH_WAIT : BATCH_GO;
+    for (i = 0; i < count; i++)
+        batch_thread(batch, i)->batch = batch;
+
+    for (created = 0; created < count; created++) {
+        rc = thread_start(batch_thread(batch, created), &attr,
+                starts[created].start_routine, starts[created].arg);
+        if (rc != 0)
+            break;
+
+        threads[created] = (pthread_t)batch_thread(batch, created);
+    }
+
+    if (rc == 0) {
+        if (flags & PTHREAD_CREATE_BATCH_SYNC_NP) {
+            InterlockedExchange(&batch->start, BATCH_GO);
+            slim_pthread_wake(&batch->start, true);
+        }
+
+        return 0;
+    }
+
+    // None of a synchronized batch has run yet, so take it all back.
+    // The unused descriptors keep the allocation alive meanwhile.
+    if (flags & PTHREAD_CREATE_BATCH_SYNC_NP) {
+        InterlockedExchange(&batch->start, BATCH_ABORT);
+        slim_pthread_wake(&batch->start, true);
+
+        for (i = 0; i < created; i++) {
+            if (attr.detachstate != PTHREAD_CREATE_DETACHED)
+                pthread_join(threads[i], NULL);
+            threads[i] = NULL;
+        }
+    }
+
+    for (i = created; i < count; i++) {
+        threads[i] = NULL;
+        slim_pthread_free(batch_thread(batch, i));
+    }
+
+    return rc;
+}
+
 int pthread_detach(pthread_t __thread)
 {
     slim_pthread_t thread = (slim_pthread_t)__thread;
@@ -119,11 +723,22 @@ int pthread_detach(pthread_t __thread)
     if (!thread || thread->sig != _PTHREAD_INIT)
         return EINVAL;
 
-    if (thread->detached)
-        return EINVAL;
+    switch (InterlockedCompareExchange(&thread->joinstate, THREAD_DETACHED,
+            THREAD_JOINABLE)) {
+    case THREAD_JOINABLE:
+        return 0;
 
-    thread->detached = true;
-    return 0;
+    case THREAD_EXITED:
+        // Nobody will join it, release it here. Only cached threads borrow
+        // a handle, and those start out detached.
+        if (thread->handle)
+            CloseHandle(thread->handle);
+        slim_pthread_free(thread);
+        return 0;
+
+    default:
+        return EINVAL;
+    }
 }
 
 int pthread_equal(pthread_t t1, pthread_t t2)
@@ -131,6 +746,10 @@ int pthread_equal(pthread_t t1, pthread_t t2)
     if (!t1 || t1->__sig != _PTHREAD_INIT || !t2 || t1->__sig != _PTHREAD_INIT)
         return 0;
 
+    // Process scope threads have no OS thread id of their own.
+    if (((slim_pthread_t)t1)->fiber || ((slim_pthread_t)t2)->fiber)
+        return t1 == t2;
+
     return ((slim_pthread_t)t1)->id == ((slim_pthread_t)t2)->id;
 }
 
@@ -142,28 +761,34 @@ void pthread_exit(void *value_ptr)
     }
 
     self->exit_value_ptr = value_ptr;
+
+    if (self->fiber)
+        slim_pthread_fiber_exit();
+
     slim_pthread_cleanup();
+
+    // The worker frame is unwound without reaching the cache.
+    if (current_worker && current_worker->handle)
+        CloseHandle(current_worker->handle);
+
     _endthreadex(0);
 }
 
+static volatile long concurrency = 0;
+
 int pthread_getconcurrency(void)
 {
-    // Always succeeds, so return 0 for non pthread.
-    if (!self)
-        return 0;
-
-    return self->concurrency;
+    return concurrency;
 }
 
+// Sizes the carrier pool running process scope threads.
 int pthread_setconcurrency(int level)
 {
-    if (!self)
-        return ENOTSUP;
-
     if (level < 0)
         return EINVAL;
 
-    self->concurrency = level;
+    concurrency = level;
+    slim_pthread_carriers_resize(level);
     return 0;
 }
 
@@ -188,19 +813,24 @@ int pthread_setschedparam(pthread_t __thread, int policy,
         const struct sched_param *param)
 {
     slim_pthread_t thread = (slim_pthread_t)__thread;
+    HANDLE handle;
 
     if (!thread || thread->sig != _PTHREAD_INIT)
         return ESRCH;
 
-    if ((policy & (~SCHED_RESET_ON_FORK)) < SCHED_OTHER ||
-            (policy & (~SCHED_RESET_ON_FORK)) > SCHED_IDLE)
+    if (!param || !sched_valid(policy, param->sched_priority))
         return EINVAL;
 
-    if ((policy & (~SCHED_RESET_ON_FORK)) != SCHED_OTHER)
-        return ENOTSUP;
+    // Process scope threads share the priority of their carrier.
+    if (!thread->fiber) {
+        handle = slim_pthread_handle(thread);
+        if (!handle)
+            return ESRCH;
 
-    if (!param || param->sched_priority != 0)
-        return EINVAL;
+        if (!SetThreadPriority(handle,
+                sched_level(policy, param->sched_priority)))
+            return EPERM;
+    }
 
     thread->schedpolicy = policy;
     thread->schedpriority = param->sched_priority;
@@ -208,6 +838,94 @@ int pthread_setschedparam(pthread_t __thread, int policy,
     return 0;
 }
 
+/*
+ * Join deadlines are GetTickCount64() values, JOIN_FOREVER never passes
+ * and 0 has always passed.
+ */
+#define JOIN_FOREVER                    ULLONG_MAX
+
+// Bumped whenever a joinable thread exits, see pthread_join_any_np().
+static volatile long thread_exits = 0;
+
+// Hands a joinable thread over to its joiner. Returns false if the thread
+// is detached, and the caller has to release it.
+bool slim_pthread_mark_exited(slim_pthread_t thread)
+{
+    if (InterlockedCompareExchange(&thread->joinstate, THREAD_EXITED,
+            THREAD_JOINABLE) != THREAD_JOINABLE)
+        return false;
+
+    slim_pthread_wake(&thread->joinstate, true);
+
+    InterlockedIncrement(&thread_exits);
+    slim_pthread_wake(&thread_exits, true);
+    return true;
+}
+
+static ULONGLONG join_deadline(const struct timespec *abstime)
+{
+    return GetTickCount64() + slim_pthread_abstime_ms(abstime);
+}
+
+static DWORD join_remaining(ULONGLONG deadline)
+{
+    ULONGLONG now;
+
+    if (deadline == JOIN_FOREVER)
+        return INFINITE;
+
+    now = GetTickCount64();
+    if (now >= deadline)
+        return 0;
+
+    return deadline - now < INFINITE ? (DWORD)(deadline - now) : INFINITE - 1;
+}
+
+// Waits for the thread to exit until the deadline. Returns false if it
+// is still running then, or was detached meanwhile.
+//
+// The exit state is set once the thread is done with its descriptor, so
+// joiners park on it rather than in the kernel. The OS thread still runs
+// the CRT and DLL_THREAD_DETACH after that, so system scope threads are
+// waited for too before code they may run can be unloaded; by then the
+// handle wait hardly ever blocks.
+static bool join_wait(slim_pthread_t thread, ULONGLONG deadline)
+{
+    long joinable = THREAD_JOINABLE;
+    DWORD milliseconds;
+
+    while (thread->joinstate == THREAD_JOINABLE) {
+        milliseconds = join_remaining(deadline);
+        if (!milliseconds)
+            return false;
+
+        slim_pthread_wait(&thread->joinstate, &joinable, sizeof(joinable),
+                milliseconds);
+    }
+
+    if (thread->joinstate != THREAD_EXITED)
+        return false;
+
+    // Process scope threads have no handle, and their fiber is deleted.
+    if (!thread->handle)
+        return true;
+
+    return WaitForSingleObject(thread->handle,
+            join_remaining(deadline)) == WAIT_OBJECT_0;
+}
+
+static void join_reap(slim_pthread_t thread, void **value_ptr)
+{
+    if (value_ptr)
+        *value_ptr = thread->exit_value_ptr;
+
+    // Joinable threads own their handle, process scope ones have none.
+    if (thread->handle)
+        CloseHandle(thread->handle);
+
+    slim_pthread_free(thread);
+}
+
 int pthread_join(pthread_t __thread, void **value_ptr)
 {
     slim_pthread_t thread = (slim_pthread_t)__thread;
@@ -215,41 +933,144 @@ int pthread_join(pthread_t __thread, void **value_ptr)
     if (!thread || thread->sig != _PTHREAD_INIT)
         return ESRCH;
 
-    if (thread->detached)
+    if (thread->joinstate == THREAD_DETACHED)
         return EINVAL;
 
-    if (WaitForSingleObject(thread->handle, INFINITE) != WAIT_OBJECT_0)
-        return EINTR;
+    if (!join_wait(thread, JOIN_FOREVER))
+        return EINVAL;
 
-    if (value_ptr)
-        *value_ptr = thread->exit_value_ptr;
+    join_reap(thread, value_ptr);
+    return 0;
+}
+
+int pthread_tryjoin_np(pthread_t __thread, void **value_ptr)
+{
+    slim_pthread_t thread = (slim_pthread_t)__thread;
+
+    if (!thread || thread->sig != _PTHREAD_INIT)
+        return ESRCH;
 
-    memset(thread, 0, sizeof(struct opaque_pthread_t));
-    free(thread);
+    if (thread->joinstate == THREAD_DETACHED)
+        return EINVAL;
+
+    if (!join_wait(thread, 0))
+        return EBUSY;
+
+    join_reap(thread, value_ptr);
     return 0;
 }
 
-pthread_t pthread_self(void)
+int pthread_timedjoin_np(pthread_t __thread, void **value_ptr,
+        const struct timespec *abstime)
 {
-    if (!self) {
-        self = (slim_pthread_t)calloc(1, sizeof(struct opaque_pthread_t));
-        if (self) {
-            self->sig = _PTHREAD_INIT;
-            self->handle = GetCurrentThread();
-            self->id = GetCurrentThreadId();
-            self->detached = true;
-            self->cancelstate = PTHREAD_CANCEL_ENABLE;
-            self->canceltype = PTHREAD_CANCEL_DEFERRED;
-            self->schedpolicy = SCHED_OTHER;
-            self->schedpriority = 0;
-            self->start_routine = NULL;
-            self->start_arg = NULL;
+    slim_pthread_t thread = (slim_pthread_t)__thread;
+
+    if (!thread || thread->sig != _PTHREAD_INIT)
+        return ESRCH;
+
+    if (thread->joinstate == THREAD_DETACHED || !abstime)
+        return EINVAL;
+
+    if (!join_wait(thread, join_deadline(abstime)))
+        return ETIMEDOUT;
+
+    join_reap(thread, value_ptr);
+    return 0;
+}
+
+int pthread_join_any_np(const pthread_t *threads, unsigned int count,
+        unsigned int *index, void **value_ptr, const struct timespec *abstime)
+{
+    slim_pthread_t thread;
+    ULONGLONG deadline;
+    DWORD milliseconds;
+    unsigned int i;
+    bool any = false;
+    long exits;
+
+    if (!threads || !index)
+        return EINVAL;
+
+    for (i = 0; i < count; i++) {
+        thread = (slim_pthread_t)threads[i];
+        if (!thread)
+            continue;
+
+        if (thread->sig != _PTHREAD_INIT)
+            return ESRCH;
+
+        if (thread->joinstate == THREAD_DETACHED)
+            return EINVAL;
+
+        any = true;
+    }
+
+    if (!any)
+        return EINVAL;
+
+    deadline = abstime ? join_deadline(abstime) : JOIN_FOREVER;
+
+    for (;;) {
+        // Read before scanning, so an exit during the scan is not missed.
+        exits = thread_exits;
+
+        for (i = 0; i < count; i++) {
+            thread = (slim_pthread_t)threads[i];
+
+            if (thread && thread->joinstate == THREAD_EXITED) {
+                if (!join_wait(thread, deadline))
+                    return ETIMEDOUT;
+
+                *index = i;
+                join_reap(thread, value_ptr);
+                return 0;
+            }
         }
+
+        milliseconds = join_remaining(deadline);
+        if (!milliseconds)
+            return ETIMEDOUT;
+
+        slim_pthread_wait(&thread_exits, &exits, sizeof(exits), milliseconds);
     }
+}
+
+pthread_t __slim_pthread_self(void)
+{
+    slim_pthread_t thread = (slim_pthread_t)&foreign;
+
+    if (self)
+        return (pthread_t)self;
+
+    // Other threads need a real handle to act on this one, the
+    // GetCurrentThread() pseudo handle would name themselves.
+    if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+            GetCurrentProcess(), (HANDLE *)&thread->handle, 0, FALSE,
+            DUPLICATE_SAME_ACCESS))
+        thread->handle = NULL;
+
+    thread->sig = _PTHREAD_INIT;
+    thread->id = GetCurrentThreadId();
+    thread->joinstate = THREAD_DETACHED;
+    thread->cancelstate = PTHREAD_CANCEL_ENABLE;
+    thread->canceltype = PTHREAD_CANCEL_DEFERRED;
+    thread->schedpolicy = SCHED_OTHER;
+    thread->schedpriority = 0;
+    thread->start_routine = NULL;
+    thread->start_arg = NULL;
+    slim_pthread_set_self(thread);
 
     return (pthread_t)self;
 }
 
+pthread_t pthread_self(void)
+{
+    if (self)
+        return (pthread_t)self;
+
+    return __slim_pthread_self();
+}
+
 PTHREAD_API
 int pthread_setcancelstate(int state, int *oldstate)
 {
@@ -322,6 +1143,10 @@ int pthread_attr_init(pthread_attr_t *__attr)
     attr->schedpriority = 0;
     attr->schedpolicy = SCHED_OTHER;
     attr->contentionscope = PTHREAD_SCOPE_SYSTEM;
+    attr->stackpolicy = PTHREAD_STACK_RESERVE_NP;
+    attr->numanode = PTHREAD_NUMA_NODE_ANY_NP;
+    attr->has_cpuset = false;
+    CPU_ZERO(&attr->cpuset);
 
     return 0;
 }
@@ -423,8 +1248,13 @@ int pthread_attr_setschedparam(pthread_attr_t *__attr,
 {
     slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
 
-    if (!attr || attr->sig != _PTHREAD_ATTR_INIT ||
-            !param || param->sched_priority != 0)
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT || !param)
+        return EINVAL;
+
+    // The policy may still change, so only reject priorities no policy
+    // takes. attr_prepare() checks the pair.
+    if (param->sched_priority < 0 ||
+            param->sched_priority > __SLIM_SCHED_RT_PRIORITY_MAX)
         return EINVAL;
 
     attr->schedpriority = param->sched_priority;
@@ -445,17 +1275,12 @@ int pthread_attr_getschedpolicy(const pthread_attr_t *__attr, int *policy)
 int pthread_attr_setschedpolicy(pthread_attr_t *__attr, int policy)
 {
     slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
+    int min, max;
 
-    if (!attr || attr->sig != _PTHREAD_ATTR_INIT)
-        return EINVAL;
-
-    if ((policy & (~SCHED_RESET_ON_FORK)) < SCHED_OTHER ||
-            (policy & (~SCHED_RESET_ON_FORK)) > SCHED_IDLE)
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT ||
+            !sched_range(policy, &min, &max))
         return EINVAL;
 
-    if ((policy & (~SCHED_RESET_ON_FORK)) != SCHED_OTHER)
-        return ENOTSUP;
-
     attr->schedpolicy = policy;
     return 0;
 }
@@ -482,9 +1307,6 @@ int pthread_attr_setscope(pthread_attr_t *__attr, int contentionscope)
             contentionscope != PTHREAD_SCOPE_PROCESS))
         return EINVAL;
 
-    if (contentionscope == PTHREAD_SCOPE_PROCESS)
-        return ENOTSUP;
-
     attr->contentionscope = contentionscope;
     return 0;
 }
@@ -568,3 +1390,27 @@ int pthread_attr_setstacksize(pthread_attr_t *__attr, size_t stacksize)
     attr->stacksize = stacksize;
     return 0;
 }
+
+int pthread_attr_getstackpolicy_np(const pthread_attr_t *__attr, int *policy)
+{
+    slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT || !policy)
+        return EINVAL;
+
+    *policy = attr->stackpolicy;
+    return 0;
+}
+
+int pthread_attr_setstackpolicy_np(pthread_attr_t *__attr, int policy)
+{
+    slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT ||
+            (policy != PTHREAD_STACK_RESERVE_NP &&
+            policy != PTHREAD_STACK_COMMIT_NP))
+        return EINVAL;
+
+    attr->stackpolicy = policy;
+    return 0;
+}
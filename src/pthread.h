@@ -24,6 +24,8 @@
 #define __PTHREAD_H__
 
 #include <windows.h>
+#include <intrin.h>
+#include <stdio.h>
 #include <errno.h>
 
 #ifdef __cplusplus
@@ -46,14 +48,16 @@ extern "C" {
 
 #define __PTHREAD_MUTEXATTR_SIZE__      20
 #define __PTHREAD_MUTEX_SIZE__          116
-#define __PTHREAD_RWLOCKATTR_SIZE__     4
-#define __PTHREAD_RWLOCK_SIZE__         20
+#define __PTHREAD_RWLOCKATTR_SIZE__     8
+#define __PTHREAD_RWLOCK_SIZE__         36
 #define __PTHREAD_CONDATTR_SIZE__       4
-#define __PTHREAD_COND_SIZE__           12
-#define __PTHREAD_BARRIERATTR_SIZE__    4
-#define __PTHREAD_BARRIER_SIZE__        36
-#define __PTHREAD_ATTR_SIZE__           52
-#define __PTHREAD_SIZE__                84
+#define __PTHREAD_COND_SIZE__           36
+#define __PTHREAD_SEQLOCK_SIZE__        8
+#define __PTHREAD_BARRIERATTR_SIZE__    44
+#define __PTHREAD_BARRIER_SIZE__        52
+#define __PTHREAD_PHASER_SIZE__         4
+#define __PTHREAD_ATTR_SIZE__           316
+#define __PTHREAD_SIZE__                164
 
 typedef struct opaque_pthread_mutexattr_t {
     int __sig;
@@ -75,6 +79,32 @@ typedef struct opaque_pthread_rwlock_t {
     char __opaque[__PTHREAD_RWLOCK_SIZE__];
 } pthread_rwlock_t;
 
+/*
+ * Per rwlock statistics, only collected for locks created while enabled,
+ * see pthread_rwlockattr_setstats_np() and SLIM_PTHREAD_RWLOCK_STATS.
+ * Histograms use power of two buckets: bucket n counts samples in
+ * [2^n, 2^(n+1)), bucket 0 also counts zero. Times are in nanoseconds.
+ */
+#define PTHREAD_RWLOCK_STATS_BUCKETS_NP 32
+
+struct pthread_rwlock_stats_np {
+    unsigned long long rdlocks;
+    unsigned long long wrlocks;
+    unsigned long long rdlocks_contended;
+    unsigned long long wrlocks_contended;
+    unsigned long long upgrades;
+    unsigned long long downgrades;
+    unsigned long long readers[PTHREAD_RWLOCK_STATS_BUCKETS_NP];
+    unsigned long long wrwait[PTHREAD_RWLOCK_STATS_BUCKETS_NP];
+    unsigned long long wrhold[PTHREAD_RWLOCK_STATS_BUCKETS_NP];
+};
+
+typedef struct opaque_pthread_seqlock_t {
+    int __sig;
+    volatile long __seq;
+    char __opaque[__PTHREAD_SEQLOCK_SIZE__];
+} pthread_seqlock_t;
+
 typedef struct opaque_pthread_condattr_t {
     int __sig;
     char __opaque[__PTHREAD_CONDATTR_SIZE__];
@@ -95,6 +125,13 @@ typedef struct opaque_pthread_barrier_t {
     char __opaque[__PTHREAD_BARRIER_SIZE__];
 } pthread_barrier_t;
 
+/* The phaser state word comes last to keep it 8 byte aligned */
+typedef struct opaque_pthread_phaser_t {
+    int __sig;
+    char __opaque[__PTHREAD_PHASER_SIZE__];
+    volatile long long __state;
+} pthread_phaser_t;
+
 typedef struct opaque_pthread_attr_t {
     int __sig;
     char __opaque[__PTHREAD_ATTR_SIZE__];
@@ -106,21 +143,86 @@ struct __slim_pthread_cleanup_handler {
     struct __slim_pthread_cleanup_handler *__next;
 };
 
+/* One thread specific value, see pthread_getspecific() */
+struct __slim_pthread_specific {
+    unsigned int __key;
+    void *__value;
+};
+
 typedef struct opaque_pthread_t {
     int __sig;
     struct __slim_pthread_cleanup_handler *__cleanup_stack;
+    unsigned int __specific_size;
+    struct __slim_pthread_specific *__specific;
     char __opaque[__PTHREAD_SIZE__];
 } *pthread_t;
 
-typedef INIT_ONCE pthread_once_t;
+/* __done is set once the init routine has returned, see pthread_once() */
+typedef struct opaque_pthread_once_t {
+    INIT_ONCE __once;
+    volatile long __done;
+} pthread_once_t;
+
+/* Phase of a barrier, as returned by pthread_barrier_arrive_np() */
+typedef long pthread_barrier_token_np;
+
+/*
+ * A key is an index into the per-thread value array in the low bits plus
+ * a generation in the high bits, which changes each time a deleted index
+ * is handed out again. Zero is never a valid key.
+ */
+typedef unsigned int pthread_key_t;
+
+#define __SLIM_PTHREAD_KEY_INDEX_BITS   20
+#define __SLIM_PTHREAD_KEY_INDEX_MASK   ((1u << __SLIM_PTHREAD_KEY_INDEX_BITS) - 1)
+
+/*
+ * Static key, see PTHREAD_STATIC_KEY_NP(). __slot returns the calling
+ * thread's storage, which lives in the image declaring the key.
+ */
+struct __slim_pthread_static_slot {
+    void *__value;
+    int __used;
+};
 
-struct __slim_pthread_key_t;
-typedef struct __slim_pthread_key_t *pthread_key_t;
+typedef struct __slim_pthread_static_key {
+    void (*__destructor)(void *);
+    struct __slim_pthread_static_slot *(*__slot)(void);
+} pthread_static_key_np;
 
 struct sched_param {
     int sched_priority;
 };
 
+/* One thread of pthread_create_batch_np() */
+typedef struct pthread_start_np {
+    void *(*start_routine)(void *);
+    void *arg;
+} pthread_start_np;
+
+/* Release the threads of a batch together once all of them exist */
+#define PTHREAD_CREATE_BATCH_SYNC_NP    0x01
+
+/*
+ * CPU sets for the affinity functions. CPU n is processor n % 64 of
+ * processor group n / 64, so a set can name every CPU of a machine with
+ * several processor groups.
+ */
+#define CPU_SETSIZE                     2048
+
+typedef struct {
+    unsigned long long __bits[CPU_SETSIZE / 64];
+} cpu_set_t;
+
+#define CPU_ZERO(set)                   ZeroMemory((set), sizeof(cpu_set_t))
+#define CPU_SET(cpu, set)               ((void)((unsigned)(cpu) < CPU_SETSIZE ? \
+        ((set)->__bits[(cpu) / 64] |= 1ULL << ((cpu) % 64)) : 0))
+#define CPU_CLR(cpu, set)               ((void)((unsigned)(cpu) < CPU_SETSIZE ? \
+        ((set)->__bits[(cpu) / 64] &= ~(1ULL << ((cpu) % 64))) : 0))
+#define CPU_ISSET(cpu, set)             ((unsigned)(cpu) < CPU_SETSIZE && \
+        (((set)->__bits[(cpu) / 64] >> ((cpu) % 64)) & 1))
+#define CPU_COUNT(set)                  __slim_pthread_cpu_count(set)
+
 /*
  * Scheduling policies from sched.h
  */
@@ -132,6 +234,17 @@ struct sched_param {
 
 #define SCHED_RESET_ON_FORK             0x40000000
 
+/*
+ * Windows has no real time policies, SCHED_FIFO and SCHED_RR both map
+ * sched_priority 1-49 to THREAD_PRIORITY_ABOVE_NORMAL, 50-98 to
+ * THREAD_PRIORITY_HIGHEST and 99 to THREAD_PRIORITY_TIME_CRITICAL.
+ * SCHED_OTHER runs at THREAD_PRIORITY_NORMAL, SCHED_BATCH at
+ * THREAD_PRIORITY_BELOW_NORMAL and SCHED_IDLE at THREAD_PRIORITY_IDLE, all
+ * with sched_priority 0.
+ */
+#define __SLIM_SCHED_RT_PRIORITY_MIN    1
+#define __SLIM_SCHED_RT_PRIORITY_MAX    99
+
 /*
  * Thread attributes
  */
@@ -141,6 +254,16 @@ struct sched_param {
 #define PTHREAD_INHERIT_SCHED           1
 #define PTHREAD_EXPLICIT_SCHED          2
 
+/*
+ * Thread stack commit policies. RESERVE only reserves the stack size and
+ * commits pages as the stack grows, COMMIT commits it all up front.
+ */
+#define PTHREAD_STACK_RESERVE_NP        0
+#define PTHREAD_STACK_COMMIT_NP         1
+
+/* Default of pthread_attr_setnumanode_np(), no NUMA node preference */
+#define PTHREAD_NUMA_NODE_ANY_NP        (-1)
+
 #define PTHREAD_CANCEL_ENABLE           0x01  /* Cancel takes place at next cancellation point */
 #define PTHREAD_CANCEL_DISABLE          0x00  /* Cancel postponed */
 
@@ -150,7 +273,15 @@ struct sched_param {
 /* Value returned from pthread_join() when a thread is canceled */
 #define PTHREAD_CANCELED                ((void *)-1)
 
-/* We only support PTHREAD_SCOPE_SYSTEM */
+/*
+ * PTHREAD_SCOPE_PROCESS threads are fibers run by a pool of carrier
+ * threads sized by pthread_setconcurrency(), one per processor at level 0.
+ * They block alone in library mutexes, conds and joins, anything else
+ * blocks their carrier. Native thread local storage and RCU read sections
+ * belong to the carrier, setting a static key fails with ENOTSUP, and the
+ * stack defaults to a 256 KB reservation. Priority, affinity and guard
+ * attributes do not apply.
+ */
 #define PTHREAD_SCOPE_SYSTEM            1
 #define PTHREAD_SCOPE_PROCESS           2
 
@@ -160,6 +291,20 @@ struct sched_param {
 #define PTHREAD_PROCESS_SHARED          1
 #define PTHREAD_PROCESS_PRIVATE         2
 
+/*
+ * Barrier spin attribute, the default spins a little before blocking on
+ * multiprocessor machines and never on uniprocessor ones.
+ */
+#define PTHREAD_BARRIER_SPIN_DEFAULT_NP (-1)
+
+/*
+ * Barrier type attribute. Central barriers count arrivals on one word;
+ * tree barriers combine arrivals up a tree of fan-in 4 and release down
+ * it, which scales better with many threads. Tree barriers are private.
+ */
+#define PTHREAD_BARRIER_CENTRAL_NP      0
+#define PTHREAD_BARRIER_TREE_NP         1
+
 /*
  * Mutex protocol attributes
  */
@@ -181,6 +326,7 @@ struct sched_param {
 #define _PTHREAD_MUTEX_INIT             0x73706D74
 #define _PTHREAD_COND_INIT              0x73706376
 #define _PTHREAD_RWLOCK_INIT            0x73706C6B
+#define _PTHREAD_SEQLOCK_INIT           0x7370736C
 
 /*
  * Mutex variables
@@ -193,6 +339,11 @@ struct sched_param {
  */
 #define PTHREAD_RWLOCK_INITIALIZER      {_PTHREAD_RWLOCK_INIT, {0}}
 
+/*
+ * Sequence lock variables
+ */
+#define PTHREAD_SEQLOCK_INITIALIZER_NP  {_PTHREAD_SEQLOCK_INIT, 0, {0}}
+
 /*
  * Condition variables
  */
@@ -206,13 +357,24 @@ struct sched_param {
  /*
   * Initialization control (once) variables
   */
-#define PTHREAD_ONCE_INIT               INIT_ONCE_STATIC_INIT
+#define PTHREAD_ONCE_INIT               {INIT_ONCE_STATIC_INIT, 0}
 
 /*
  * Min thread stack size on Windows
  */
 #define PTHREAD_STACK_MIN               65536
 
+/*
+ * Keys are not backed by Windows TLS slots, the only limit is the index
+ * range.
+ */
+#define PTHREAD_KEYS_MAX                (__SLIM_PTHREAD_KEY_INDEX_MASK + 1)
+
+/*
+ * Max destructor passes at thread exit, for values set by destructors
+ */
+#define PTHREAD_DESTRUCTOR_ITERATIONS   4
+
  /*
   * Cancel cleanup handler management. Note, since these are implemented
   * as macros, they *MUST* occur in matched pairs!
@@ -311,6 +473,30 @@ int pthread_rwlock_wrlock(pthread_rwlock_t *lock);
 PTHREAD_API
 int pthread_rwlock_unlock(pthread_rwlock_t *lock);
 
+/*
+ * Upgradable read locks. An upgradable reader shares the lock with plain
+ * readers but excludes writers and other upgradable readers, so it can be
+ * converted to a write lock without letting a writer in between. A write
+ * or upgradable lock can be downgraded to a plain read lock atomically.
+ * The upgrade is not atomic with respect to plain readers: it drops its
+ * shared hold and waits for the readers left to go, so it fails with
+ * EDEADLK if the caller also holds the lock for reading.
+ */
+PTHREAD_API
+int pthread_rwlock_uprdlock_np(pthread_rwlock_t *lock);
+
+PTHREAD_API
+int pthread_rwlock_tryuprdlock_np(pthread_rwlock_t *lock);
+
+PTHREAD_API
+int pthread_rwlock_upgrade_np(pthread_rwlock_t *lock);
+
+PTHREAD_API
+int pthread_rwlock_tryupgrade_np(pthread_rwlock_t *lock);
+
+PTHREAD_API
+int pthread_rwlock_downgrade_np(pthread_rwlock_t *lock);
+
 PTHREAD_API
 int pthread_rwlockattr_destroy(pthread_rwlockattr_t *attr);
 
@@ -324,6 +510,63 @@ int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *attr,
 PTHREAD_API
 int pthread_rwlockattr_setpshared(pthread_rwlockattr_t *attr, int shared);
 
+PTHREAD_API
+int pthread_rwlockattr_getstats_np(const pthread_rwlockattr_t *attr,
+        int *enable);
+
+PTHREAD_API
+int pthread_rwlockattr_setstats_np(pthread_rwlockattr_t *attr, int enable);
+
+PTHREAD_API
+int pthread_rwlock_getstats_np(pthread_rwlock_t *lock,
+        struct pthread_rwlock_stats_np *stats);
+
+/*
+ * Calls callback for every lock with statistics enabled, stopping at the
+ * first nonzero return, which is returned. The callback must not destroy
+ * locks.
+ */
+PTHREAD_API
+int pthread_rwlock_enumstats_np(int (*callback)(pthread_rwlock_t *lock,
+        const struct pthread_rwlock_stats_np *stats, void *arg), void *arg);
+
+PTHREAD_API
+int pthread_rwlock_dumpstats_np(FILE *stream);
+
+PTHREAD_API
+int pthread_seqlock_init_np(pthread_seqlock_t *lock);
+
+PTHREAD_API
+int pthread_seqlock_destroy_np(pthread_seqlock_t *lock);
+
+PTHREAD_API
+int pthread_seqlock_write_lock_np(pthread_seqlock_t *lock);
+
+PTHREAD_API
+int pthread_seqlock_write_unlock_np(pthread_seqlock_t *lock);
+
+/*
+ * Read-copy-update. Read-side critical sections only publish an epoch in
+ * thread local storage; writers publish a new version of the data and then
+ * wait for a grace period (pthread_rcu_synchronize_np) or defer freeing the
+ * old one (pthread_rcu_call_np) until every reader that could still see it
+ * has left its critical section. Readers must not block on writers.
+ */
+PTHREAD_API
+void pthread_rcu_read_lock_np(void);
+
+PTHREAD_API
+void pthread_rcu_read_unlock_np(void);
+
+PTHREAD_API
+int pthread_rcu_synchronize_np(void);
+
+PTHREAD_API
+int pthread_rcu_call_np(void (*func)(void *), void *arg);
+
+PTHREAD_API
+int pthread_rcu_barrier_np(void);
+
 PTHREAD_API
 int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
 
@@ -365,6 +608,24 @@ int pthread_barrier_destroy(pthread_barrier_t *barrier);
 PTHREAD_API
 int pthread_barrier_wait(pthread_barrier_t *barrier);
 
+/*
+ * Split phase barrier waits: arrive returns at once with a token for the
+ * current phase, and PTHREAD_BARRIER_SERIAL_THREAD for the thread that
+ * completes it; wait blocks until the phase of a token has completed.
+ * Each participant arrives once per phase and has to wait on its token
+ * before the barrier can be destroyed: an arrival counts the thread as
+ * inside the barrier until its wait, so pthread_barrier_destroy() blocks
+ * for ever on a thread that arrives and never waits. Central private
+ * barriers only.
+ */
+PTHREAD_API
+int pthread_barrier_arrive_np(pthread_barrier_t *barrier,
+        pthread_barrier_token_np *token);
+
+PTHREAD_API
+int pthread_barrier_wait_np(pthread_barrier_t *barrier,
+        pthread_barrier_token_np token);
+
 PTHREAD_API
 int pthread_barrierattr_init(pthread_barrierattr_t *attr);
 
@@ -379,13 +640,104 @@ PTHREAD_API
 int pthread_barrierattr_setpshared(pthread_barrierattr_t *attr,
         int shared);
 
+/*
+ * Number of times a waiter polls the barrier generation before it blocks,
+ * or PTHREAD_BARRIER_SPIN_DEFAULT_NP. Process shared barriers always block.
+ */
+PTHREAD_API
+int pthread_barrierattr_getspin_np(const pthread_barrierattr_t *attr,
+        int *spin);
+
+PTHREAD_API
+int pthread_barrierattr_setspin_np(pthread_barrierattr_t *attr, int spin);
+
+PTHREAD_API
+int pthread_barrierattr_gettype_np(const pthread_barrierattr_t *attr,
+        int *type);
+
+PTHREAD_API
+int pthread_barrierattr_settype_np(pthread_barrierattr_t *attr, int type);
+
+/*
+ * Reducing barriers: each thread passes a value of 'size' bytes to
+ * pthread_barrier_reduce_np() and the thread completing the phase folds
+ * them with reduce(accumulator, value), which must be associative and
+ * commutative. The completion callback runs once per phase on that thread
+ * before anybody is released, with the reduced value or NULL. Threads
+ * calling pthread_barrier_wait() on a reducing barrier contribute nothing.
+ * Neither is available on process shared barriers, and reduction is not
+ * available on tree barriers.
+ */
+PTHREAD_API
+int pthread_barrierattr_setreduce_np(pthread_barrierattr_t *attr,
+        size_t size, void (*reduce)(void *accumulator, const void *value));
+
+PTHREAD_API
+int pthread_barrierattr_setcompletion_np(pthread_barrierattr_t *attr,
+        void (*completion)(void *result, void *arg), void *arg);
+
+PTHREAD_API
+int pthread_barrier_reduce_np(pthread_barrier_t *barrier, const void *value,
+        void *result);
+
+/*
+ * Phasers are barriers whose parties can change between phases. A party
+ * registering joins the phase in progress; deregistering counts as its
+ * arrival for that phase, and either change sets how many parties the
+ * next phase waits for. Arrive returns at once with the phase arrived at,
+ * and PTHREAD_BARRIER_SERIAL_THREAD for the arrival that advanced it;
+ * await advance blocks while the phaser is still in the given phase.
+ * Up to 65535 parties.
+ */
+PTHREAD_API
+int pthread_phaser_init_np(pthread_phaser_t *phaser, unsigned int parties);
+
+PTHREAD_API
+int pthread_phaser_destroy_np(pthread_phaser_t *phaser);
+
+PTHREAD_API
+int pthread_phaser_register_np(pthread_phaser_t *phaser, unsigned int *phase);
+
+PTHREAD_API
+int pthread_phaser_deregister_np(pthread_phaser_t *phaser,
+        unsigned int *phase);
+
+PTHREAD_API
+int pthread_phaser_arrive_np(pthread_phaser_t *phaser, unsigned int *phase);
+
+PTHREAD_API
+int pthread_phaser_await_advance_np(pthread_phaser_t *phaser,
+        unsigned int phase);
+
+PTHREAD_API
+int pthread_phaser_wait_np(pthread_phaser_t *phaser);
+
+#ifdef SLIM_PTHREAD_BUILD
 PTHREAD_API
 int pthread_once(pthread_once_t *once_control, void(*init_routine)(void));
+#endif
+
+/* Slow path of the inline pthread_once() */
+PTHREAD_API
+int __slim_pthread_once(pthread_once_t *once_control,
+        void(*init_routine)(void));
 
 PTHREAD_API
 int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
         void *(*start_routine)(void *), void *arg);
 
+/*
+ * Creates count threads from one attr, thread i running
+ * starts[i].start_routine(starts[i].arg), with all the descriptors in one
+ * allocation. With PTHREAD_CREATE_BATCH_SYNC_NP no start routine runs
+ * before every thread exists, and a failure leaves no thread behind.
+ * Otherwise threads start as they are created, and a failure leaves the
+ * ones created so far running, the rest of threads set to NULL.
+ */
+PTHREAD_API
+int pthread_create_batch_np(pthread_t *threads, const pthread_attr_t *attr,
+        const pthread_start_np *starts, unsigned int count, int flags);
+
 PTHREAD_API
 int pthread_detach(pthread_t thread);
 
@@ -406,23 +758,72 @@ PTHREAD_API
 int pthread_setschedparam(pthread_t thread, int policy,
         const struct sched_param *param);
 
+PTHREAD_API
+int sched_get_priority_min(int policy);
+
+PTHREAD_API
+int sched_get_priority_max(int policy);
+
 PTHREAD_API
 int pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
 
 PTHREAD_API
 int pthread_key_delete(pthread_key_t key);
 
+#ifdef SLIM_PTHREAD_BUILD
 PTHREAD_API
 void* pthread_getspecific(pthread_key_t);
 
 PTHREAD_API
 int pthread_setspecific(pthread_key_t , const void *value);
+#endif
+
+/* Slow path of the inline pthread_setspecific() */
+PTHREAD_API
+int __slim_pthread_setspecific(pthread_key_t key, const void *value);
+
+/* TLS slot holding the calling thread's pthread_t, if it has one */
+PTHREAD_API
+extern DWORD __slim_pthread_self_slot;
+
+/* Registers a static key for destruction at exit of the calling thread */
+PTHREAD_API
+int __slim_pthread_static_key_use(const pthread_static_key_np *key);
 
 PTHREAD_API
 int pthread_join(pthread_t thread, void **value_ptr);
 
+/* pthread_join() returning EBUSY rather than waiting for the thread */
+PTHREAD_API
+int pthread_tryjoin_np(pthread_t thread, void **value_ptr);
+
+/*
+ * pthread_join() giving up with ETIMEDOUT at abstime, which is on the
+ * clock of pthread_cond_timedwait(). The deadline moves to the monotonic
+ * clock on entry, so later clock changes do not shift it.
+ */
+PTHREAD_API
+int pthread_timedjoin_np(pthread_t thread, void **value_ptr,
+        const struct timespec *abstime);
+
+/*
+ * Joins whichever of the count threads exits first and stores its
+ * position in *index. NULL entries are skipped, so reaped threads can be
+ * cleared from the set. abstime works as for pthread_timedjoin_np(), NULL
+ * waits forever.
+ */
+PTHREAD_API
+int pthread_join_any_np(const pthread_t *threads, unsigned int count,
+        unsigned int *index, void **value_ptr, const struct timespec *abstime);
+
+#ifdef SLIM_PTHREAD_BUILD
 PTHREAD_API
 pthread_t pthread_self(void);
+#endif
+
+/* Slow path of the inline pthread_self(), run once by foreign threads */
+PTHREAD_API
+pthread_t __slim_pthread_self(void);
 
 PTHREAD_API
 int pthread_setcancelstate(int state, int *oldstate);
@@ -436,9 +837,22 @@ void pthread_testcancel(void);
 PTHREAD_API
 int pthread_cancel(pthread_t thread);
 
+/* Number of carriers for PTHREAD_SCOPE_PROCESS threads, 0 for automatic */
 PTHREAD_API
 int pthread_setconcurrency(int level);
 
+/*
+ * Thread cache, disabled by default. Up to max_threads detached threads
+ * park after their start routine returns and are handed to the next
+ * pthread_create() with the same stack size instead of a new OS thread.
+ * A parked thread exits after idle_ms without work.
+ */
+PTHREAD_API
+int pthread_setcacheparams_np(unsigned int max_threads, unsigned int idle_ms);
+
+PTHREAD_API
+int pthread_getcacheparams_np(unsigned int *max_threads, unsigned int *idle_ms);
+
 PTHREAD_API
 int pthread_kill(pthread_t thread, int sig);
 
@@ -457,6 +871,12 @@ int pthread_attr_setdetachstate(pthread_attr_t *attr, int detachstate);
 PTHREAD_API
 int pthread_attr_getguardsize(const pthread_attr_t *attr, size_t *guardsize);
 
+/*
+ * A non zero guardsize makes that many bytes at the end of the stack
+ * reservation inaccessible, rounded up to pages and committed. Running
+ * into them faults at once. pthread_create() fails with EINVAL if they do
+ * not fit in the stack.
+ */
 PTHREAD_API
 int pthread_attr_setguardsize(pthread_attr_t *attr, size_t guardsize);
 
@@ -506,6 +926,216 @@ int pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *stacksize);
 PTHREAD_API
 int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize);
 
+PTHREAD_API
+int pthread_attr_getaffinity_np(const pthread_attr_t *attr,
+        size_t cpusetsize, cpu_set_t *cpuset);
+
+PTHREAD_API
+int pthread_attr_setaffinity_np(pthread_attr_t *attr,
+        size_t cpusetsize, const cpu_set_t *cpuset);
+
+PTHREAD_API
+int pthread_getaffinity_np(pthread_t thread,
+        size_t cpusetsize, cpu_set_t *cpuset);
+
+PTHREAD_API
+int pthread_setaffinity_np(pthread_t thread,
+        size_t cpusetsize, const cpu_set_t *cpuset);
+
+/*
+ * NUMA placement. A thread created with a node runs on that node's
+ * processors from its first instruction, so its stack and first touch
+ * allocations come from the node's memory. An affinity set in the same
+ * attr takes precedence. Both are no-ops on single node machines.
+ */
+PTHREAD_API
+int pthread_attr_getnumanode_np(const pthread_attr_t *attr, int *node);
+
+PTHREAD_API
+int pthread_attr_setnumanode_np(pthread_attr_t *attr, int node);
+
+PTHREAD_API
+int pthread_getnumanode_np(int *node);
+
+PTHREAD_API
+int pthread_attr_getstackpolicy_np(const pthread_attr_t *attr, int *policy);
+
+PTHREAD_API
+int pthread_attr_setstackpolicy_np(pthread_attr_t *attr, int policy);
+
+/*
+ * Inline fast paths. These only read state published by the library, so
+ * they never call into it and never write shared memory.
+ */
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define __slim_pthread_acquire_fence()  _ReadWriteBarrier()
+#else
+#define __slim_pthread_acquire_fence()  MemoryBarrier()
+#endif
+
+/*
+ * Seqlock readers take a snapshot of the sequence, read the protected data
+ * and retry if a writer ran in between:
+ *
+ *     do {
+ *         seq = pthread_seqlock_read_begin_np(&lock);
+ *         copy = data;
+ *     } while (pthread_seqlock_read_retry_np(&lock, seq));
+ */
+static __inline
+unsigned int pthread_seqlock_read_begin_np(const pthread_seqlock_t *lock)
+{
+    unsigned int seq;
+
+    while ((seq = (unsigned int)lock->__seq) & 1)
+        YieldProcessor();
+
+    __slim_pthread_acquire_fence();
+    return seq;
+}
+
+static __inline
+int pthread_seqlock_read_retry_np(const pthread_seqlock_t *lock,
+        unsigned int seq)
+{
+    __slim_pthread_acquire_fence();
+    return (unsigned int)lock->__seq != seq;
+}
+
+static __inline
+int __slim_pthread_cpu_count(const cpu_set_t *set)
+{
+    unsigned long long bits;
+    int i, count = 0;
+
+    for (i = 0; i < CPU_SETSIZE / 64; i++) {
+        for (bits = set->__bits[i]; bits; bits &= bits - 1)
+            count++;
+    }
+
+    return count;
+}
+
+#ifndef SLIM_PTHREAD_BUILD
+/*
+ * Once the init routine has run, pthread_once() is a single load and
+ * never calls into the library.
+ */
+static __inline
+int pthread_once(pthread_once_t *once_control, void(*init_routine)(void))
+{
+    if (once_control && once_control->__done) {
+        __slim_pthread_acquire_fence();
+        return 0;
+    }
+
+    return __slim_pthread_once(once_control, init_routine);
+}
+#endif
+
+#ifndef SLIM_PTHREAD_BUILD
+/*
+ * Thread specific values live in an array hung off the thread descriptor
+ * and indexed by the key, so get and set are a bounds check and a load or
+ * store. Threads only grow their array in pthread_setspecific(), so a
+ * miss on get means the value was never set. Entries left by a deleted
+ * key carry its old generation and never match a new key.
+ */
+static __inline
+void* pthread_getspecific(pthread_key_t key)
+{
+    pthread_t self = (pthread_t)TlsGetValue(__slim_pthread_self_slot);
+    unsigned int index = key & __SLIM_PTHREAD_KEY_INDEX_MASK;
+
+    if (self && index < self->__specific_size &&
+            self->__specific[index].__key == key)
+        return self->__specific[index].__value;
+
+    return NULL;
+}
+
+static __inline
+int pthread_setspecific(pthread_key_t key, const void *value)
+{
+    pthread_t self = (pthread_t)TlsGetValue(__slim_pthread_self_slot);
+    unsigned int index = key & __SLIM_PTHREAD_KEY_INDEX_MASK;
+
+    if (self && index < self->__specific_size &&
+            self->__specific[index].__key == key) {
+        self->__specific[index].__value = (void *)value;
+        return 0;
+    }
+
+    return __slim_pthread_setspecific(key, value);
+}
+
+/*
+ * Threads not created by pthread_create() get their descriptor on the
+ * first call, from static thread local storage, after which this is a
+ * TLS load.
+ */
+static __inline
+pthread_t pthread_self(void)
+{
+    pthread_t self = (pthread_t)TlsGetValue(__slim_pthread_self_slot);
+
+    if (self)
+        return self;
+
+    return __slim_pthread_self();
+}
+#endif
+
+/*
+ * Static keys keep their value in native thread local storage of the image
+ * declaring them, so get and set cost a TLS access, and still have POSIX
+ * destructor semantics. The first non NULL set in a thread registers the
+ * key with that thread, which runs the destructor at exit along with the
+ * destructors of ordinary keys. PTHREAD_STATIC_KEY_NP() defines a file
+ * scope key, and the image declaring it must stay loaded while threads
+ * hold values for it:
+ *
+ *     PTHREAD_STATIC_KEY_NP(trace_key, free);
+ *
+ *     buf = pthread_static_getspecific_np(trace_key);
+ *     pthread_static_setspecific_np(trace_key, buf);
+ */
+#define PTHREAD_STATIC_KEY_NP(name, destructor) \
+    static __declspec(thread) struct __slim_pthread_static_slot \
+            __slim_pthread_static_##name; \
+    static struct __slim_pthread_static_slot * \
+            __slim_pthread_static_slot_##name(void) \
+    { \
+        return &__slim_pthread_static_##name; \
+    } \
+    static const pthread_static_key_np name = { \
+            (destructor), __slim_pthread_static_slot_##name }
+
+#define pthread_static_getspecific_np(name) \
+    (__slim_pthread_static_##name.__value)
+
+#define pthread_static_setspecific_np(name, value) \
+    __slim_pthread_static_setspecific(&(name), \
+            &__slim_pthread_static_##name, (value))
+
+static __inline
+int __slim_pthread_static_setspecific(const pthread_static_key_np *key,
+        struct __slim_pthread_static_slot *slot, const void *value)
+{
+    if (!slot->__used && value) {
+        int rc = __slim_pthread_static_key_use(key);
+        if (rc != 0)
+            return rc;
+    }
+
+    slot->__value = (void *)value;
+    return 0;
+}
+
+/*
+ * Static builds receive thread notifications through a TLS callback, so
+ * there is no need to call this from the DllMain of the image anymore.
+ */
 #ifndef SLIM_PTHREAD_DYNAMIC
 BOOL pthead_module_main(
         HMODULE hModule, DWORD  ul_reason_for_call, LPVOID lpReserved);
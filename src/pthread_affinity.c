@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <windows.h>
+#include <errno.h>
+#include <string.h>
+
+#include "pthread_impl.h"
+
+#define AFFINITY_GROUPS                 (CPU_SETSIZE / 64)
+
+/*
+ * A thread's group affinity is limited to a single processor group. Sets
+ * spanning several groups go through CPU set masks, which only exist on
+ * Windows 11 and Server 2022 and later, so they are looked up at runtime.
+ */
+typedef BOOL (WINAPI *set_masks_t)(HANDLE, PGROUP_AFFINITY, USHORT);
+typedef BOOL (WINAPI *get_masks_t)(HANDLE, PGROUP_AFFINITY, USHORT, PUSHORT);
+
+static INIT_ONCE masks_once = INIT_ONCE_STATIC_INIT;
+static set_masks_t set_masks = NULL;
+static get_masks_t get_masks = NULL;
+
+static
+BOOL CALLBACK masks_setup(PINIT_ONCE InitOnce, PVOID Parameter, PVOID *lpContext)
+{
+    HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+
+    if (kernel32) {
+        set_masks = (set_masks_t)GetProcAddress(kernel32,
+                "SetThreadSelectedCpuSetMasks");
+        get_masks = (get_masks_t)GetProcAddress(kernel32,
+                "GetThreadSelectedCpuSetMasks");
+    }
+
+    return TRUE;
+}
+
+bool slim_pthread_affinity_valid(const cpu_set_t *cpuset)
+{
+    WORD groups = GetActiveProcessorGroupCount();
+    unsigned long long present;
+    DWORD count;
+    WORD group;
+    bool empty = true;
+
+    for (group = 0; group < AFFINITY_GROUPS; group++) {
+        if (!cpuset->__bits[group])
+            continue;
+
+        if (group >= groups)
+            return false;
+
+        count = GetActiveProcessorCount(group);
+        if (count > sizeof(KAFFINITY) * 8)
+            count = sizeof(KAFFINITY) * 8;
+
+        present = count >= 64 ? ~0ULL : (1ULL << count) - 1;
+        if (cpuset->__bits[group] & ~present)
+            return false;
+
+        empty = false;
+    }
+
+    return !empty;
+}
+
+int slim_pthread_affinity_apply(HANDLE handle, const cpu_set_t *cpuset)
+{
+    GROUP_AFFINITY affinity[AFFINITY_GROUPS];
+    USHORT count = 0;
+    WORD group;
+
+    InitOnceExecuteOnce(&masks_once, masks_setup, NULL, NULL);
+
+    ZeroMemory(affinity, sizeof(affinity));
+    for (group = 0; group < AFFINITY_GROUPS; group++) {
+        if (!cpuset->__bits[group])
+            continue;
+
+        affinity[count].Group = group;
+        affinity[count].Mask = (KAFFINITY)cpuset->__bits[group];
+        count++;
+    }
+
+    if (count == 0)
+        return EINVAL;
+
+    if (count == 1) {
+        // Drop CPU set masks left by an earlier multi group set, they
+        // would otherwise keep restricting the thread.
+        if (set_masks)
+            set_masks(handle, NULL, 0);
+
+        return SetThreadGroupAffinity(handle, &affinity[0], NULL) ?
+                0 : EINVAL;
+    }
+
+    if (!set_masks)
+        return EINVAL;
+
+    return set_masks(handle, affinity, count) ? 0 : EINVAL;
+}
+
+static int affinity_query(HANDLE handle, cpu_set_t *cpuset)
+{
+    GROUP_AFFINITY affinity[AFFINITY_GROUPS];
+    USHORT count = 0, i;
+
+    InitOnceExecuteOnce(&masks_once, masks_setup, NULL, NULL);
+
+    CPU_ZERO(cpuset);
+
+    if (get_masks && get_masks(handle, affinity, AFFINITY_GROUPS, &count) &&
+            count > 0) {
+        for (i = 0; i < count; i++) {
+            if (affinity[i].Group < AFFINITY_GROUPS)
+                cpuset->__bits[affinity[i].Group] |= affinity[i].Mask;
+        }
+        return 0;
+    }
+
+    if (!GetThreadGroupAffinity(handle, &affinity[0]))
+        return ESRCH;
+
+    if (affinity[0].Group < AFFINITY_GROUPS)
+        cpuset->__bits[affinity[0].Group] = affinity[0].Mask;
+
+    return 0;
+}
+
+// Callers may pass sets smaller or larger than cpu_set_t, CPUs past the
+// end of theirs are taken as clear.
+static void affinity_copy_in(cpu_set_t *dest, size_t cpusetsize,
+        const cpu_set_t *src)
+{
+    CPU_ZERO(dest);
+    memcpy(dest, src, cpusetsize < sizeof(cpu_set_t) ?
+            cpusetsize : sizeof(cpu_set_t));
+}
+
+static int affinity_copy_out(cpu_set_t *dest, size_t cpusetsize,
+        const cpu_set_t *src)
+{
+    size_t i;
+
+    if (cpusetsize >= sizeof(cpu_set_t)) {
+        memset(dest, 0, cpusetsize);
+        memcpy(dest, src, sizeof(cpu_set_t));
+        return 0;
+    }
+
+    for (i = cpusetsize; i < sizeof(cpu_set_t); i++) {
+        if (((const unsigned char *)src)[i])
+            return EINVAL;
+    }
+
+    memcpy(dest, src, cpusetsize);
+    return 0;
+}
+
+int pthread_attr_getaffinity_np(const pthread_attr_t *__attr,
+        size_t cpusetsize, cpu_set_t *cpuset)
+{
+    slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
+    cpu_set_t all;
+    WORD group, groups;
+
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT || !cpuset || !cpusetsize)
+        return EINVAL;
+
+    if (attr->has_cpuset)
+        return affinity_copy_out(cpuset, cpusetsize, &attr->cpuset);
+
+    // No affinity set, threads may run on any CPU.
+    CPU_ZERO(&all);
+    groups = GetActiveProcessorGroupCount();
+    for (group = 0; group < groups && group < AFFINITY_GROUPS; group++) {
+        DWORD count = GetActiveProcessorCount(group);
+        all.__bits[group] = count >= 64 ? ~0ULL : (1ULL << count) - 1;
+    }
+
+    return affinity_copy_out(cpuset, cpusetsize, &all);
+}
+
+int pthread_attr_setaffinity_np(pthread_attr_t *__attr,
+        size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
+    cpu_set_t set;
+
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT)
+        return EINVAL;
+
+    // A NULL set goes back to the default, no affinity.
+    if (!cpuset || !cpusetsize) {
+        attr->has_cpuset = false;
+        return 0;
+    }
+
+    affinity_copy_in(&set, cpusetsize, cpuset);
+    if (!slim_pthread_affinity_valid(&set))
+        return EINVAL;
+
+    attr->cpuset = set;
+    attr->has_cpuset = true;
+    return 0;
+}
+
+int pthread_getaffinity_np(pthread_t __thread,
+        size_t cpusetsize, cpu_set_t *cpuset)
+{
+    slim_pthread_t thread = (slim_pthread_t)__thread;
+    cpu_set_t set;
+    HANDLE handle;
+    int rc;
+
+    if (!thread || thread->sig != _PTHREAD_INIT)
+        return ESRCH;
+
+    // Process scope threads run on whichever carrier is free.
+    if (!cpuset || !cpusetsize || thread->fiber)
+        return EINVAL;
+
+    handle = slim_pthread_handle(thread);
+    if (!handle)
+        return ESRCH;
+
+    rc = affinity_query(handle, &set);
+    if (rc != 0)
+        return rc;
+
+    return affinity_copy_out(cpuset, cpusetsize, &set);
+}
+
+int pthread_setaffinity_np(pthread_t __thread,
+        size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    slim_pthread_t thread = (slim_pthread_t)__thread;
+    cpu_set_t set;
+    HANDLE handle;
+    int rc;
+
+    if (!thread || thread->sig != _PTHREAD_INIT)
+        return ESRCH;
+
+    if (!cpuset || !cpusetsize || thread->fiber)
+        return EINVAL;
+
+    affinity_copy_in(&set, cpusetsize, cpuset);
+    if (!slim_pthread_affinity_valid(&set))
+        return EINVAL;
+
+    handle = slim_pthread_handle(thread);
+    if (!handle)
+        return ESRCH;
+
+    rc = slim_pthread_affinity_apply(handle, &set);
+    if (rc == 0)
+        thread->affinity = true;
+
+    return rc;
+}
+
+static ULONG numa_highest_node(void)
+{
+    ULONG highest;
+
+    if (!GetNumaHighestNodeNumber(&highest))
+        return 0;
+
+    return highest;
+}
+
+// Whether threads created with the node need placing at all.
+bool slim_pthread_numa_placed(int node)
+{
+    return node != PTHREAD_NUMA_NODE_ANY_NP && numa_highest_node() > 0;
+}
+
+int slim_pthread_numa_apply(HANDLE handle, int node)
+{
+    GROUP_AFFINITY affinity;
+    PROCESSOR_NUMBER ideal;
+    KAFFINITY mask;
+
+    if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) ||
+            !affinity.Mask)
+        return EINVAL;
+
+    if (!SetThreadGroupAffinity(handle, &affinity, NULL))
+        return EINVAL;
+
+    // Page faults are served from the ideal processor's node first, this
+    // is what places the stack and first touch allocations.
+    ZeroMemory(&ideal, sizeof(ideal));
+    ideal.Group = affinity.Group;
+    for (mask = affinity.Mask; !(mask & 1); mask >>= 1)
+        ideal.Number++;
+
+    SetThreadIdealProcessorEx(handle, &ideal, NULL);
+    return 0;
+}
+
+int pthread_attr_getnumanode_np(const pthread_attr_t *__attr, int *node)
+{
+    slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT || !node)
+        return EINVAL;
+
+    *node = attr->numanode;
+    return 0;
+}
+
+int pthread_attr_setnumanode_np(pthread_attr_t *__attr, int node)
+{
+    slim_pthread_attr_t *attr = (slim_pthread_attr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_ATTR_INIT)
+        return EINVAL;
+
+    if (node != PTHREAD_NUMA_NODE_ANY_NP &&
+            (node < 0 || (ULONG)node > numa_highest_node()))
+        return EINVAL;
+
+    attr->numanode = node;
+    return 0;
+}
+
+int pthread_getnumanode_np(int *node)
+{
+    PROCESSOR_NUMBER number;
+    USHORT current;
+
+    if (!node)
+        return EINVAL;
+
+    GetCurrentProcessorNumberEx(&number);
+    if (!GetNumaProcessorNodeEx(&number, &current))
+        current = 0;
+
+    *node = current;
+    return 0;
+}
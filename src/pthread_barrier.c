@@ -23,9 +23,332 @@
 #include <windows.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "pthread_impl.h"
 
+/*
+ * Private barriers count arrivals down; the last thread in resets the
+ * count and bumps the generation word, which everybody else polls for a
+ * while and then blocks on with WaitOnAddress.
+ *
+ * Threads count themselves inside the barrier from arriving until they
+ * are done reading it, so that pthread_barrier_destroy() right after a
+ * phase completes waits for the released threads to get out first.
+ */
+#define BARRIER_SPIN_COUNT              1000
+
+static void barrier_enter(slim_pthread_barrier_t *barrier)
+{
+    InterlockedIncrement(&barrier->inside);
+}
+
+// The barrier may be gone once this returns.
+static void barrier_leave(slim_pthread_barrier_t *barrier)
+{
+    if (InterlockedDecrement(&barrier->inside) == 0)
+        WakeByAddressAll((PVOID)&barrier->inside);
+}
+
+static unsigned int barrier_spin(const slim_pthread_barrierattr_t *attr)
+{
+    SYSTEM_INFO info;
+
+    if (attr && attr->spin != PTHREAD_BARRIER_SPIN_DEFAULT_NP)
+        return (unsigned int)attr->spin;
+
+    // Spinning cannot help when the thread that would release us needs
+    // the only processor.
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 1 ? BARRIER_SPIN_COUNT : 0;
+}
+
+/*
+ * Reducing barriers give every arrival of a phase its own slot, indexed
+ * by the arrival count. The thread completing the phase folds the filled
+ * slots into the result and runs the completion callback before anybody
+ * is released; the result stays put until the next phase completes, which
+ * cannot happen before every thread has copied it out and arrived again.
+ */
+static int barrier_reduce_init(slim_pthread_barrier_t *barrier,
+        const slim_pthread_barrierattr_t *attr)
+{
+    slim_pthread_barrier_reduce_t *reduce;
+
+    barrier->reduce = NULL;
+    if (!attr || (!attr->reduce && !attr->completion))
+        return 0;
+
+    reduce = (slim_pthread_barrier_reduce_t *)calloc(1,
+            sizeof(slim_pthread_barrier_reduce_t));
+    if (!reduce)
+        return ENOMEM;
+
+    reduce->reduce = attr->reduce;
+    reduce->completion = attr->completion;
+    reduce->completion_arg = attr->completion_arg;
+
+    if (reduce->reduce) {
+        reduce->size = attr->reduce_size;
+        reduce->stride = (BARRIER_SLOT_VALUE + reduce->size +
+                BARRIER_CACHE_LINE - 1) & ~(size_t)(BARRIER_CACHE_LINE - 1);
+        if (reduce->stride > SIZE_MAX / barrier->count) {
+            free(reduce);
+            return ENOMEM;
+        }
+
+        reduce->slots = (char *)_aligned_malloc(
+                reduce->stride * barrier->count, BARRIER_CACHE_LINE);
+        reduce->result = (char *)malloc(reduce->size);
+        if (!reduce->slots || !reduce->result) {
+            if (reduce->slots)
+                _aligned_free(reduce->slots);
+            free(reduce->result);
+            free(reduce);
+            return ENOMEM;
+        }
+
+        memset(reduce->slots, 0, reduce->stride * barrier->count);
+    }
+
+    barrier->reduce = reduce;
+    return 0;
+}
+
+static void barrier_reduce_destroy(slim_pthread_barrier_t *barrier)
+{
+    slim_pthread_barrier_reduce_t *reduce = barrier->reduce;
+
+    if (!reduce)
+        return;
+
+    if (reduce->slots)
+        _aligned_free(reduce->slots);
+    free(reduce->result);
+    free(reduce);
+}
+
+static slim_pthread_barrier_slot_t *barrier_slot(
+        slim_pthread_barrier_reduce_t *reduce, long index)
+{
+    return (slim_pthread_barrier_slot_t *)(reduce->slots +
+            (size_t)index * reduce->stride);
+}
+
+static void barrier_contribute(slim_pthread_barrier_t *barrier, long index,
+        const void *value, long generation)
+{
+    slim_pthread_barrier_reduce_t *reduce = barrier->reduce;
+    slim_pthread_barrier_slot_t *slot;
+
+    if (!reduce || !reduce->reduce)
+        return;
+
+    slot = barrier_slot(reduce, index);
+    slot->filled = value != NULL;
+    if (value)
+        memcpy((char *)slot + BARRIER_SLOT_VALUE, value, reduce->size);
+
+    InterlockedExchange(&slot->ready, (long)((unsigned long)generation + 1));
+}
+
+static void barrier_complete(slim_pthread_barrier_t *barrier, long generation)
+{
+    slim_pthread_barrier_reduce_t *reduce = barrier->reduce;
+    slim_pthread_barrier_slot_t *slot;
+    long ready = (long)((unsigned long)generation + 1);
+    unsigned int spin;
+    bool first = true;
+    long i;
+
+    if (!reduce)
+        return;
+
+    if (reduce->reduce) {
+        memset(reduce->result, 0, reduce->size);
+        for (i = 0; i < (long)barrier->count; i++) {
+            // Every arrival fills its slot right after taking it.
+            slot = barrier_slot(reduce, i);
+            for (spin = 0; slot->ready != ready; spin++) {
+                if (spin < BARRIER_SPIN_COUNT)
+                    YieldProcessor();
+                else
+                    Sleep(0);
+            }
+            __slim_pthread_acquire_fence();
+
+            if (!slot->filled)
+                continue;
+
+            if (first)
+                memcpy(reduce->result, (char *)slot + BARRIER_SLOT_VALUE,
+                        reduce->size);
+            else
+                reduce->reduce(reduce->result,
+                        (char *)slot + BARRIER_SLOT_VALUE);
+            first = false;
+        }
+    }
+
+    if (reduce->completion)
+        reduce->completion(reduce->reduce ? reduce->result : NULL,
+                reduce->completion_arg);
+}
+
+/*
+ * Tree barriers keep an array of nodes next to the barrier, leaves first
+ * and the root last. Each leaf takes up to BARRIER_FANIN threads and each
+ * inner node up to BARRIER_FANIN children. The thread completing a node
+ * moves on to its parent, every other one waits on the node's release
+ * word; whoever completes the root starts the next generation and then
+ * releases the nodes it completed, whose waiters release theirs in turn.
+ */
+#define BARRIER_FANIN                   4
+#define BARRIER_MAX_DEPTH               16
+
+static int barrier_tree_init(slim_pthread_barrier_t *barrier)
+{
+    slim_pthread_barrier_node_t *node;
+    unsigned int below, width, first, total, i;
+
+    total = 0;
+    width = barrier->count;
+    do {
+        width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+        total += width;
+    } while (width > 1);
+
+    barrier->nodes = (slim_pthread_barrier_node_t *)_aligned_malloc(
+            total * sizeof(slim_pthread_barrier_node_t), BARRIER_CACHE_LINE);
+    if (!barrier->nodes)
+        return ENOMEM;
+
+    memset(barrier->nodes, 0, total * sizeof(slim_pthread_barrier_node_t));
+
+    first = 0;
+    below = barrier->count;
+    width = (below + BARRIER_FANIN - 1) / BARRIER_FANIN;
+    barrier->leaves = width;
+    for (;;) {
+        for (i = 0; i < width; i++) {
+            node = &barrier->nodes[first + i];
+            node->expected = below - i * BARRIER_FANIN < BARRIER_FANIN ?
+                    (long)(below - i * BARRIER_FANIN) : BARRIER_FANIN;
+            node->parent = width > 1 ?
+                    (long)(first + width + i / BARRIER_FANIN) : -1;
+        }
+
+        if (width == 1)
+            break;
+
+        first += width;
+        below = width;
+        width = (below + BARRIER_FANIN - 1) / BARRIER_FANIN;
+    }
+
+    return 0;
+}
+
+/*
+ * Counts one arrival at a node for the generation in 'tag' and returns how
+ * many arrived so far, or 0 if the node is already full.
+ */
+static long barrier_node_arrive(slim_pthread_barrier_node_t *node,
+        unsigned long tag)
+{
+    long arrived, next, prev;
+
+    arrived = node->arrived;
+    for (;;) {
+        if (((unsigned long)arrived & ~BARRIER_ARRIVED_MASK) != tag)
+            next = (long)(tag | 1);
+        else if ((arrived & BARRIER_ARRIVED_MASK) >= node->expected)
+            return 0;
+        else
+            next = arrived + 1;
+
+        prev = InterlockedCompareExchange(&node->arrived, next, arrived);
+        if (prev == arrived)
+            return next & BARRIER_ARRIVED_MASK;
+        arrived = prev;
+    }
+}
+
+static void barrier_node_wait(slim_pthread_barrier_t *barrier,
+        slim_pthread_barrier_node_t *node, long release)
+{
+    unsigned int spin;
+    long current;
+
+    for (spin = barrier->spin; spin > 0; spin--) {
+        if (node->release == release)
+            return;
+        YieldProcessor();
+    }
+
+    while ((current = node->release) != release)
+        WaitOnAddress(&node->release, &current, sizeof(current), INFINITE);
+}
+
+static int barrier_wait_tree(slim_pthread_barrier_t *barrier)
+{
+    slim_pthread_barrier_node_t *nodes = barrier->nodes;
+    long path[BARRIER_MAX_DEPTH];
+    long generation, release, index, arrived;
+    unsigned long tag;
+    unsigned int probe;
+    int depth = 0;
+    int rc = 0;
+
+    barrier_enter(barrier);
+
+    // The generation cannot move before this thread has arrived.
+    generation = barrier->generation;
+    release = (long)((unsigned long)generation + 1);
+    tag = (unsigned long)generation << BARRIER_ARRIVED_BITS;
+
+    // Spread threads over the leaves by id and probe on from a full one,
+    // a thread usually lands on the same leaf every phase.
+    index = (long)(((GetCurrentThreadId() >> 2) * 2654435761u) %
+            barrier->leaves);
+    probe = 0;
+    while ((arrived = barrier_node_arrive(&nodes[index], tag)) == 0) {
+        index = (index + 1) % (long)barrier->leaves;
+        if (++probe % barrier->leaves == 0)
+            Sleep(0);
+    }
+
+    for (;;) {
+        if (arrived != nodes[index].expected) {
+            barrier_node_wait(barrier, &nodes[index], release);
+            break;
+        }
+
+        path[depth++] = index;
+        index = nodes[index].parent;
+        if (index < 0) {
+            barrier_complete(barrier, generation);
+            InterlockedIncrement(&barrier->generation);
+            rc = PTHREAD_BARRIER_SERIAL_THREAD;
+            break;
+        }
+
+        arrived = barrier_node_arrive(&nodes[index], tag);
+    }
+
+    // Release the nodes completed on the way up, nearest the root first.
+    while (depth > 0) {
+        index = path[--depth];
+        InterlockedExchange(&nodes[index].release, release);
+        WakeByAddressAll((PVOID)&nodes[index].release);
+    }
+
+    barrier_leave(barrier);
+    return rc;
+}
+
 int pthread_barrier_init(pthread_barrier_t *__barrier,
         const pthread_barrierattr_t *__attr, unsigned int count)
 {
@@ -33,21 +356,63 @@ int pthread_barrier_init(pthread_barrier_t *__barrier,
     slim_pthread_barrierattr_t *attr = (slim_pthread_barrierattr_t *)__attr;
     long rc;
 
-    if (!barrier || count == 0)
+    if (!barrier || count == 0 || count > LONG_MAX)
         return EINVAL;
 
     if (attr && attr->sig != _PTHREAD_BARRIERATTR_INIT)
         return EINVAL;
 
+    // Callbacks mean nothing in another process, and tree barriers have
+    // no single place to gather values in.
+    if (attr && attr->shared == PTHREAD_PROCESS_SHARED &&
+            (attr->type != PTHREAD_BARRIER_CENTRAL_NP ||
+            attr->reduce || attr->completion))
+        return ENOTSUP;
+
+    if (attr && attr->type == PTHREAD_BARRIER_TREE_NP && attr->reduce)
+        return ENOTSUP;
+
     // TODO: CHECKME!!!
     if (barrier->sig != _PTHREAD_BARRIER_INIT)
         barrier->state = UNINITIALIZED;
 
     rc = InterlockedCompareExchange(&(barrier->state),
             INITIALIZING, UNINITIALIZED);
-    if (rc == UNINITIALIZED) {
+    if (rc == UNINITIALIZED && attr && attr->shared == PTHREAD_PROCESS_SHARED) {
+        rc = slim_pthread_shared_barrier_init(
+                (slim_pthread_shared_barrier_t *)barrier, count);
+        if (rc != 0) {
+            barrier->state = UNINITIALIZED;
+            return (int)rc;
+        }
+
+        barrier->sig = _PTHREAD_BARRIER_INIT;
+        barrier->state = INITIALIZED;
+    }
+    else if (rc == UNINITIALIZED) {
         barrier->sig = _PTHREAD_BARRIER_INIT;
-        InitializeSynchronizationBarrier(&barrier->syncbar, count, -1);
+        barrier->shared = PTHREAD_PROCESS_PRIVATE;
+        barrier->count = count;
+        barrier->remaining = (long)count;
+        barrier->generation = 0;
+        barrier->spin = barrier_spin(attr);
+        barrier->type = attr ? attr->type : PTHREAD_BARRIER_CENTRAL_NP;
+        barrier->leaves = 0;
+        barrier->inside = 0;
+        barrier->nodes = NULL;
+        if (barrier->type == PTHREAD_BARRIER_TREE_NP &&
+                barrier_tree_init(barrier) != 0) {
+            barrier->state = UNINITIALIZED;
+            return ENOMEM;
+        }
+
+        if (barrier_reduce_init(barrier, attr) != 0) {
+            if (barrier->nodes)
+                _aligned_free(barrier->nodes);
+            barrier->state = UNINITIALIZED;
+            return ENOMEM;
+        }
+
         barrier->state = INITIALIZED;
     }
     else {
@@ -60,34 +425,165 @@ int pthread_barrier_init(pthread_barrier_t *__barrier,
 int pthread_barrier_destroy(pthread_barrier_t *__barrier)
 {
     slim_pthread_barrier_t *barrier = (slim_pthread_barrier_t *)__barrier;
-    long rc;
+    long rc, inside;
 
     if (!barrier || barrier->sig != _PTHREAD_BARRIER_INIT)
         return EINVAL;
 
+    // Threads arrived in a phase that has not completed would never be
+    // released.
+    if (barrier->shared == PTHREAD_PROCESS_PRIVATE &&
+            barrier->type == PTHREAD_BARRIER_CENTRAL_NP &&
+            barrier->remaining != (long)barrier->count)
+        return EBUSY;
+
     rc = InterlockedCompareExchange(&(barrier->state),
             UNINITIALIZED, INITIALIZED);
-    if (rc == INITIALIZED)
-        DeleteSynchronizationBarrier(&barrier->syncbar);
+
+    // Threads released by the last phase may still be reading the
+    // generation or the tree nodes.
+    if (rc == INITIALIZED && barrier->shared != PTHREAD_PROCESS_SHARED) {
+        while ((inside = barrier->inside) != 0)
+            WaitOnAddress(&barrier->inside, &inside, sizeof(inside),
+                    INFINITE);
+    }
+
+    // Process shared barriers hold no resources between waits.
+    if (rc == INITIALIZED && barrier->shared != PTHREAD_PROCESS_SHARED) {
+        if (barrier->nodes)
+            _aligned_free(barrier->nodes);
+        barrier_reduce_destroy(barrier);
+    }
 
     memset(barrier, 0, sizeof(pthread_barrier_t));
     return 0;
 }
 
+/*
+ * Central barrier phases are numbered by the generation word, arriving
+ * hands out the current one and waiting polls for it to move on.
+ */
+static int barrier_arrive(slim_pthread_barrier_t *barrier, const void *value,
+        long *generation)
+{
+    long remaining;
+
+    barrier_enter(barrier);
+
+    // The generation cannot move before this thread has arrived.
+    *generation = barrier->generation;
+    remaining = InterlockedDecrement(&barrier->remaining);
+    barrier_contribute(barrier, remaining, value, *generation);
+    if (remaining != 0)
+        return 0;
+
+    barrier_complete(barrier, *generation);
+    InterlockedExchange(&barrier->remaining, (long)barrier->count);
+    InterlockedIncrement(&barrier->generation);
+    WakeByAddressAll((PVOID)&barrier->generation);
+    return PTHREAD_BARRIER_SERIAL_THREAD;
+}
+
+static void barrier_wait(slim_pthread_barrier_t *barrier, long generation)
+{
+    unsigned int spin;
+
+    for (spin = barrier->spin; spin > 0; spin--) {
+        if (barrier->generation != generation)
+            return;
+        YieldProcessor();
+    }
+
+    while (barrier->generation == generation)
+        WaitOnAddress(&barrier->generation, &generation,
+                sizeof(generation), INFINITE);
+}
+
 int pthread_barrier_wait(pthread_barrier_t *__barrier)
 {
     slim_pthread_barrier_t *barrier = (slim_pthread_barrier_t *)__barrier;
-    BOOL rc;
+    long generation;
+    int rc;
 
     if (!barrier || barrier->sig != _PTHREAD_BARRIER_INIT ||
             barrier->state != INITIALIZED)
         return EINVAL;
 
-    // TODO: CHECKME!!!
-    // rc = EnterSynchronizationBarrier(&barrier->syncbar, 0);
-    rc = EnterSynchronizationBarrier(&barrier->syncbar,
-            SYNCHRONIZATION_BARRIER_FLAGS_NO_DELETE);
-    return rc ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+    if (barrier->shared == PTHREAD_PROCESS_SHARED)
+        return slim_pthread_shared_barrier_wait(
+                (slim_pthread_shared_barrier_t *)barrier);
+
+    if (barrier->type == PTHREAD_BARRIER_TREE_NP)
+        return barrier_wait_tree(barrier);
+
+    rc = barrier_arrive(barrier, NULL, &generation);
+    if (rc == 0)
+        barrier_wait(barrier, generation);
+
+    barrier_leave(barrier);
+    return rc;
+}
+
+int pthread_barrier_arrive_np(pthread_barrier_t *__barrier,
+        pthread_barrier_token_np *token)
+{
+    slim_pthread_barrier_t *barrier = (slim_pthread_barrier_t *)__barrier;
+
+    if (!barrier || barrier->sig != _PTHREAD_BARRIER_INIT ||
+            barrier->state != INITIALIZED || !token)
+        return EINVAL;
+
+    // Shared waiters must each consume a semaphore count and tree waiters
+    // must release the nodes they completed, neither can skip the wait.
+    if (barrier->shared == PTHREAD_PROCESS_SHARED ||
+            barrier->type != PTHREAD_BARRIER_CENTRAL_NP)
+        return ENOTSUP;
+
+    return barrier_arrive(barrier, NULL, token);
+}
+
+int pthread_barrier_wait_np(pthread_barrier_t *__barrier,
+        pthread_barrier_token_np token)
+{
+    slim_pthread_barrier_t *barrier = (slim_pthread_barrier_t *)__barrier;
+
+    if (!barrier || barrier->sig != _PTHREAD_BARRIER_INIT ||
+            barrier->state != INITIALIZED)
+        return EINVAL;
+
+    if (barrier->shared == PTHREAD_PROCESS_SHARED ||
+            barrier->type != PTHREAD_BARRIER_CENTRAL_NP)
+        return ENOTSUP;
+
+    barrier_wait(barrier, token);
+    barrier_leave(barrier);
+    return 0;
+}
+
+int pthread_barrier_reduce_np(pthread_barrier_t *__barrier,
+        const void *value, void *result)
+{
+    slim_pthread_barrier_t *barrier = (slim_pthread_barrier_t *)__barrier;
+    long generation;
+    int rc;
+
+    if (!barrier || barrier->sig != _PTHREAD_BARRIER_INIT ||
+            barrier->state != INITIALIZED || !value)
+        return EINVAL;
+
+    if (barrier->shared == PTHREAD_PROCESS_SHARED ||
+            !barrier->reduce || !barrier->reduce->reduce)
+        return EINVAL;
+
+    rc = barrier_arrive(barrier, value, &generation);
+    if (rc == 0)
+        barrier_wait(barrier, generation);
+
+    if (result)
+        memcpy(result, barrier->reduce->result, barrier->reduce->size);
+
+    barrier_leave(barrier);
+    return rc;
 }
 
 int pthread_barrierattr_init(pthread_barrierattr_t *__attr)
@@ -96,6 +592,12 @@ int pthread_barrierattr_init(pthread_barrierattr_t *__attr)
 
     attr->sig = _PTHREAD_BARRIERATTR_INIT;
     attr->shared = PTHREAD_PROCESS_PRIVATE;
+    attr->spin = PTHREAD_BARRIER_SPIN_DEFAULT_NP;
+    attr->type = PTHREAD_BARRIER_CENTRAL_NP;
+    attr->reduce_size = 0;
+    attr->reduce = NULL;
+    attr->completion = NULL;
+    attr->completion_arg = NULL;
     return 0;
 }
 
@@ -132,3 +634,251 @@ int pthread_barrierattr_setpshared(pthread_barrierattr_t *__attr, int shared)
     attr->shared = shared;
     return 0;
 }
+
+int pthread_barrierattr_getspin_np(const pthread_barrierattr_t *__attr,
+        int *spin)
+{
+    slim_pthread_barrierattr_t *attr = (slim_pthread_barrierattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_BARRIERATTR_INIT || !spin)
+        return EINVAL;
+
+    *spin = attr->spin;
+    return 0;
+}
+
+int pthread_barrierattr_setspin_np(pthread_barrierattr_t *__attr, int spin)
+{
+    slim_pthread_barrierattr_t *attr = (slim_pthread_barrierattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_BARRIERATTR_INIT ||
+            (spin < 0 && spin != PTHREAD_BARRIER_SPIN_DEFAULT_NP))
+        return EINVAL;
+
+    attr->spin = spin;
+    return 0;
+}
+
+int pthread_barrierattr_gettype_np(const pthread_barrierattr_t *__attr,
+        int *type)
+{
+    slim_pthread_barrierattr_t *attr = (slim_pthread_barrierattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_BARRIERATTR_INIT || !type)
+        return EINVAL;
+
+    *type = attr->type;
+    return 0;
+}
+
+int pthread_barrierattr_settype_np(pthread_barrierattr_t *__attr, int type)
+{
+    slim_pthread_barrierattr_t *attr = (slim_pthread_barrierattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_BARRIERATTR_INIT ||
+            (type != PTHREAD_BARRIER_CENTRAL_NP &&
+            type != PTHREAD_BARRIER_TREE_NP))
+        return EINVAL;
+
+    attr->type = type;
+    return 0;
+}
+
+int pthread_barrierattr_setreduce_np(pthread_barrierattr_t *__attr,
+        size_t size, void (*reduce)(void *, const void *))
+{
+    slim_pthread_barrierattr_t *attr = (slim_pthread_barrierattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_BARRIERATTR_INIT ||
+            (reduce && size == 0))
+        return EINVAL;
+
+    attr->reduce_size = reduce ? size : 0;
+    attr->reduce = reduce;
+    return 0;
+}
+
+int pthread_barrierattr_setcompletion_np(pthread_barrierattr_t *__attr,
+        void (*completion)(void *, void *), void *arg)
+{
+    slim_pthread_barrierattr_t *attr = (slim_pthread_barrierattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_BARRIERATTR_INIT)
+        return EINVAL;
+
+    attr->completion = completion;
+    attr->completion_arg = completion ? arg : NULL;
+    return 0;
+}
+
+/*
+ * Phasers pack their phase, party count and the parties yet to arrive in
+ * one 64 bit word, so registering, deregistering and arriving are single
+ * compare-exchanges and membership changes cannot race an advance. The
+ * arrival that takes the unarrived count to zero moves to the next phase
+ * with every current party unarrived again. Waiters block on the phase
+ * half of the word, which only changes on an advance.
+ */
+#define PHASER_UNARRIVED_SHIFT          0
+#define PHASER_PARTIES_SHIFT            16
+#define PHASER_PHASE_SHIFT              32
+#define PHASER_PARTIES_MAX              0xFFFF
+
+#define PHASER_UNARRIVED(s) \
+    ((unsigned int)((ULONG64)(s) >> PHASER_UNARRIVED_SHIFT) & PHASER_PARTIES_MAX)
+#define PHASER_PARTIES(s) \
+    ((unsigned int)((ULONG64)(s) >> PHASER_PARTIES_SHIFT) & PHASER_PARTIES_MAX)
+#define PHASER_PHASE(s) \
+    ((unsigned int)((ULONG64)(s) >> PHASER_PHASE_SHIFT))
+#define PHASER_STATE(phase, parties, unarrived) \
+    ((LONG64)(((ULONG64)(phase) << PHASER_PHASE_SHIFT) | \
+    ((ULONG64)(parties) << PHASER_PARTIES_SHIFT) | \
+    ((ULONG64)(unarrived) << PHASER_UNARRIVED_SHIFT)))
+
+static volatile long *phaser_phase(slim_pthread_phaser_t *phaser)
+{
+    // Windows is little endian, the phase is the upper half.
+    return (volatile long *)&phaser->state + 1;
+}
+
+/*
+ * Counts one arrival, leaving the phaser when 'leave' is set, and advances
+ * the phase when it was the last one.
+ */
+static int phaser_arrive(slim_pthread_phaser_t *phaser, bool leave,
+        unsigned int *phase)
+{
+    LONG64 state, next, prev;
+    unsigned int parties, unarrived;
+
+    if (!phaser || phaser->sig != _PTHREAD_PHASER_INIT)
+        return EINVAL;
+
+    state = phaser->state;
+    for (;;) {
+        parties = PHASER_PARTIES(state);
+        unarrived = PHASER_UNARRIVED(state);
+        if (unarrived == 0)
+            return EINVAL;
+
+        if (leave)
+            parties--;
+
+        if (unarrived > 1)
+            next = PHASER_STATE(PHASER_PHASE(state), parties, unarrived - 1);
+        else
+            next = PHASER_STATE(PHASER_PHASE(state) + 1, parties, parties);
+
+        prev = InterlockedCompareExchange64(&phaser->state, next, state);
+        if (prev == state)
+            break;
+        state = prev;
+    }
+
+    if (phase)
+        *phase = PHASER_PHASE(state);
+
+    if (unarrived > 1)
+        return 0;
+
+    WakeByAddressAll((PVOID)phaser_phase(phaser));
+    return PTHREAD_BARRIER_SERIAL_THREAD;
+}
+
+int pthread_phaser_init_np(pthread_phaser_t *__phaser, unsigned int parties)
+{
+    slim_pthread_phaser_t *phaser = (slim_pthread_phaser_t *)__phaser;
+
+    if (!phaser || parties > PHASER_PARTIES_MAX)
+        return EINVAL;
+
+    phaser->sig = _PTHREAD_PHASER_INIT;
+    phaser->spin = barrier_spin(NULL);
+    phaser->state = PHASER_STATE(0, parties, parties);
+    return 0;
+}
+
+int pthread_phaser_destroy_np(pthread_phaser_t *__phaser)
+{
+    slim_pthread_phaser_t *phaser = (slim_pthread_phaser_t *)__phaser;
+
+    if (!phaser || phaser->sig != _PTHREAD_PHASER_INIT)
+        return EINVAL;
+
+    memset(phaser, 0, sizeof(pthread_phaser_t));
+    return 0;
+}
+
+int pthread_phaser_register_np(pthread_phaser_t *__phaser, unsigned int *phase)
+{
+    slim_pthread_phaser_t *phaser = (slim_pthread_phaser_t *)__phaser;
+    LONG64 state, prev;
+
+    if (!phaser || phaser->sig != _PTHREAD_PHASER_INIT)
+        return EINVAL;
+
+    state = phaser->state;
+    for (;;) {
+        if (PHASER_PARTIES(state) == PHASER_PARTIES_MAX)
+            return EAGAIN;
+
+        prev = InterlockedCompareExchange64(&phaser->state,
+                PHASER_STATE(PHASER_PHASE(state), PHASER_PARTIES(state) + 1,
+                PHASER_UNARRIVED(state) + 1), state);
+        if (prev == state)
+            break;
+        state = prev;
+    }
+
+    if (phase)
+        *phase = PHASER_PHASE(state);
+    return 0;
+}
+
+int pthread_phaser_deregister_np(pthread_phaser_t *__phaser,
+        unsigned int *phase)
+{
+    return phaser_arrive((slim_pthread_phaser_t *)__phaser, true, phase);
+}
+
+int pthread_phaser_arrive_np(pthread_phaser_t *__phaser, unsigned int *phase)
+{
+    return phaser_arrive((slim_pthread_phaser_t *)__phaser, false, phase);
+}
+
+int pthread_phaser_await_advance_np(pthread_phaser_t *__phaser,
+        unsigned int phase)
+{
+    slim_pthread_phaser_t *phaser = (slim_pthread_phaser_t *)__phaser;
+    volatile long *current;
+    long compare = (long)phase;
+    unsigned int spin;
+
+    if (!phaser || phaser->sig != _PTHREAD_PHASER_INIT)
+        return EINVAL;
+
+    current = phaser_phase(phaser);
+    for (spin = phaser->spin; spin > 0; spin--) {
+        if (*current != compare)
+            return 0;
+        YieldProcessor();
+    }
+
+    while (*current == compare)
+        WaitOnAddress(current, &compare, sizeof(compare), INFINITE);
+
+    return 0;
+}
+
+int pthread_phaser_wait_np(pthread_phaser_t *__phaser)
+{
+    unsigned int phase;
+    int rc;
+
+    // The serial arrival has advanced the phase itself.
+    rc = pthread_phaser_arrive_np(__phaser, &phase);
+    if (rc != 0)
+        return rc;
+
+    return pthread_phaser_await_advance_np(__phaser, phase);
+}
@@ -23,7 +23,6 @@
 #include <windows.h>
 #include <errno.h>
 #include <time.h>
-#include <assert.h>
 
 #include "pthread_impl.h"
 
@@ -56,6 +55,23 @@ static int _gettimeofday(struct timeval *tv)
     return 0;
 }
 
+// Milliseconds left until abstime on the realtime clock, 0 once passed.
+DWORD slim_pthread_abstime_ms(const struct timespec *abstime)
+{
+    struct timeval now;
+    long milliseconds;
+
+    _gettimeofday(&now);
+
+    milliseconds = (long)((abstime->tv_sec - now.tv_sec) * 1000) +
+        (long)((((abstime->tv_nsec + 500) / 1000) - now.tv_usec) / 1000);
+
+    if (milliseconds < 0)
+        milliseconds = 0;
+
+    return (DWORD)milliseconds;
+}
+
 int pthread_cond_init(pthread_cond_t *__cond, const pthread_condattr_t *__attr)
 {
     slim_pthread_cond_t *cond = (slim_pthread_cond_t *)__cond;
@@ -75,7 +91,11 @@ int pthread_cond_init(pthread_cond_t *__cond, const pthread_condattr_t *__attr)
     rc = InterlockedCompareExchange(&cond->state, INITIALIZING, UNINITIALIZED);
     if (rc == UNINITIALIZED) {
         cond->sig = _PTHREAD_COND_INIT;
+        InitializeSRWLock(&cond->lock);
         InitializeConditionVariable(&cond->condvar);
+        cond->sleepers = 0;
+        cond->fibers = 0;
+        cond->seq = 0;
         cond->state = INITIALIZED;
     } else {
         while (cond->state != INITIALIZED)
@@ -99,6 +119,25 @@ int pthread_cond_destroy(pthread_cond_t *__cond)
     return 0;
 }
 
+// Waking one of each kind on a signal is allowed, the other one sees a
+// spurious wakeup. Without waiters of a kind this costs a read.
+static void cond_wake(slim_pthread_cond_t *cond, bool all)
+{
+    if (cond->fibers) {
+        InterlockedIncrement(&cond->seq);
+        slim_pthread_wake(&cond->seq, all);
+    }
+
+    if (cond->sleepers) {
+        AcquireSRWLockExclusive(&cond->lock);
+        if (all)
+            WakeAllConditionVariable(&cond->condvar);
+        else
+            WakeConditionVariable(&cond->condvar);
+        ReleaseSRWLockExclusive(&cond->lock);
+    }
+}
+
 int pthread_cond_broadcast(pthread_cond_t *__cond)
 {
     slim_pthread_cond_t *cond = (slim_pthread_cond_t *)__cond;
@@ -107,7 +146,7 @@ int pthread_cond_broadcast(pthread_cond_t *__cond)
     if (!cond || cond->sig != _PTHREAD_COND_INIT)
         return EINVAL;
 
-    WakeAllConditionVariable(&(cond->condvar));
+    cond_wake(cond, true);
     return 0;
 }
 
@@ -119,35 +158,76 @@ int pthread_cond_signal(pthread_cond_t *__cond)
     if (!cond || cond->sig != _PTHREAD_COND_INIT)
         return EINVAL;
 
-    WakeConditionVariable(&(cond->condvar));
+    cond_wake(cond, false);
     return 0;
 }
 
+// System scope waiters take cond->lock before letting go of the mutex and
+// sleep on the condition variable under it, so a waker holding the mutex
+// cannot slip in between. The mutex is released by hand rather than by
+// the sleep, as process scope threads waiting for it need to be told.
+static int cond_sleep(slim_pthread_cond_t *cond, slim_pthread_mutex_t *mutex,
+        DWORD milliseconds)
+{
+    unsigned int count;
+    BOOL rc;
+
+    AcquireSRWLockExclusive(&cond->lock);
+    InterlockedIncrement(&cond->sleepers);
+    count = slim_pthread_mutex_release(mutex);
+    if (!count) {
+        InterlockedDecrement(&cond->sleepers);
+        ReleaseSRWLockExclusive(&cond->lock);
+        return EPERM;
+    }
+
+    rc = SleepConditionVariableSRW(&cond->condvar, &cond->lock,
+            milliseconds, 0);
+    InterlockedDecrement(&cond->sleepers);
+    ReleaseSRWLockExclusive(&cond->lock);
+
+    slim_pthread_mutex_acquire(mutex, count);
+    return rc ? 0 : ETIMEDOUT;
+}
+
+// Process scope waiters park until seq moves on from the value they saw
+// while still holding the mutex, so a signal in between is kept.
+static int cond_wait(slim_pthread_cond_t *cond, slim_pthread_mutex_t *mutex,
+        DWORD milliseconds)
+{
+    long seq = cond->seq;
+    unsigned int count;
+    bool woken;
+
+    if (!slim_pthread_fiber_self())
+        return cond_sleep(cond, mutex, milliseconds);
+
+    InterlockedIncrement(&cond->fibers);
+    count = slim_pthread_mutex_release(mutex);
+    if (!count) {
+        InterlockedDecrement(&cond->fibers);
+        return EPERM;
+    }
+
+    woken = slim_pthread_wait(&cond->seq, &seq, sizeof(seq), milliseconds);
+    InterlockedDecrement(&cond->fibers);
+    slim_pthread_mutex_acquire(mutex, count);
+
+    return woken ? 0 : ETIMEDOUT;
+}
+
 int pthread_cond_timedwait(pthread_cond_t *__cond, pthread_mutex_t *__mutex,
     const struct timespec *abstime)
 {
     slim_pthread_cond_t *cond = (slim_pthread_cond_t *)__cond;
     slim_pthread_mutex_t *mutex = (slim_pthread_mutex_t *)__mutex;
-    struct timeval now;
-    BOOL rc;
-
-    long milliseconds;
 
     if (!cond || cond->sig != _PTHREAD_COND_INIT ||
             !mutex || mutex->sig != _PTHREAD_MUTEX_INIT ||
             mutex->state != INITIALIZED || !abstime)
         return EINVAL;
 
-    _gettimeofday(&now);
-
-    milliseconds = (long)((abstime->tv_sec - now.tv_sec) * 1000) +
-        (long)((((abstime->tv_nsec + 500) / 1000) - now.tv_usec) / 1000);
-
-    if (milliseconds < 0)
-        milliseconds = 0;
-
-    rc = SleepConditionVariableCS(&(cond->condvar), &(mutex->cs), milliseconds);
-    return rc ? 0 : ETIMEDOUT;
+    return cond_wait(cond, mutex, slim_pthread_abstime_ms(abstime));
 }
 
 int pthread_cond_wait(pthread_cond_t *__cond, pthread_mutex_t *__mutex)
@@ -155,15 +235,12 @@ int pthread_cond_wait(pthread_cond_t *__cond, pthread_mutex_t *__mutex)
     slim_pthread_cond_t *cond = (slim_pthread_cond_t *)__cond;
     slim_pthread_mutex_t *mutex = (slim_pthread_mutex_t *)__mutex;
 
-    BOOL rc;
     if (!cond || cond->sig != _PTHREAD_COND_INIT
               || !mutex || mutex->sig != _PTHREAD_MUTEX_INIT
               || mutex->state != INITIALIZED)
         return EINVAL;
 
-    rc = SleepConditionVariableCS(&(cond->condvar), &(mutex->cs), INFINITE);
-    assert(rc == TRUE);
-    return 0;
+    return cond_wait(cond, mutex, INFINITE);
 }
 
 int pthread_condattr_init(pthread_condattr_t *__attr)
@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <windows.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <process.h>
+
+#include "pthread_impl.h"
+
+/*
+ * Process scope threads are fibers run by a pool of carrier threads, one
+ * per pthread_setconcurrency() level or one per processor for level 0.
+ * A fiber runs until it blocks in a library mutex, cond or join, or
+ * exits, and then switches back to its carrier, which resumes the next
+ * ready fiber from a shared FIFO. Anything else that blocks, including
+ * the other synchronization objects, blocks the carrier with it.
+ *
+ * A fiber may only be resumed once it is off its stack, so whatever must
+ * happen after it stops running, such as releasing the lock it queued
+ * itself under, is left to its carrier as an action.
+ */
+#define FIBER_STACK_DEFAULT             (256 * 1024)
+#define WAIT_BUCKETS                    256
+
+#define ACTION_NONE                     0
+#define ACTION_PARK                     1
+#define ACTION_EXIT                     2
+
+#define WAITER_WAITING                  0
+#define WAITER_WOKEN                    1
+#define WAITER_TIMEDOUT                 2
+
+/*
+ * A fiber parked on an address, living on the fiber's stack. Whoever
+ * moves state away from WAITER_WAITING makes the fiber ready, each list
+ * is unlinked by whoever holds its lock.
+ */
+typedef struct _slim_pthread_waiter_t {
+    volatile void *address;
+    slim_pthread_t thread;
+    volatile long state;
+    bool queued;
+    bool timed;
+    bool timer_linked;
+    ULONGLONG deadline;
+    struct _slim_pthread_waiter_t *prev;
+    struct _slim_pthread_waiter_t *next;
+    struct _slim_pthread_waiter_t *timer_prev;
+    struct _slim_pthread_waiter_t *timer_next;
+} slim_pthread_waiter_t;
+
+typedef struct _slim_pthread_wait_bucket_t {
+    SRWLOCK lock;
+    slim_pthread_waiter_t *head;
+    slim_pthread_waiter_t *tail;
+} slim_pthread_wait_bucket_t;
+
+typedef struct _slim_pthread_carrier_t {
+    void *fiber;
+    int action;
+    SRWLOCK *action_lock;
+    slim_pthread_waiter_t *action_waiter;
+    slim_pthread_t action_thread;
+} slim_pthread_carrier_t;
+
+static SRWLOCK carriers_lock = SRWLOCK_INIT;
+static volatile long carrier_count = 0;
+static volatile long carrier_target = 0;
+static volatile bool carriers_started = false;
+
+static SRWLOCK run_lock = SRWLOCK_INIT;
+static slim_pthread_t run_head = NULL;
+static slim_pthread_t run_tail = NULL;
+static volatile long run_count = 0;
+
+static slim_pthread_wait_bucket_t buckets[WAIT_BUCKETS];
+static volatile long fiber_waiters = 0;
+
+static SRWLOCK timer_lock = SRWLOCK_INIT;
+static slim_pthread_waiter_t *volatile timer_head = NULL;
+static ULONGLONG timer_next = ULLONG_MAX;
+
+slim_pthread_t slim_pthread_fiber_self(void)
+{
+    slim_pthread_t thread;
+
+    if (!carriers_started)
+        return NULL;
+
+    thread = (slim_pthread_t)TlsGetValue(__slim_pthread_self_slot);
+    return thread && thread->fiber ? thread : NULL;
+}
+
+// Identity of the caller for lock ownership. Fibers share the thread id
+// of their carrier, so they are named by their descriptor instead. The
+// low bit keeps the two kinds apart.
+uintptr_t slim_pthread_owner(void)
+{
+    slim_pthread_t thread = slim_pthread_fiber_self();
+
+    if (thread)
+        return (uintptr_t)thread;
+
+    return ((uintptr_t)GetCurrentThreadId() << 1) | 1;
+}
+
+static void run_push(slim_pthread_t thread)
+{
+    AcquireSRWLockExclusive(&run_lock);
+    thread->fiber_next = NULL;
+    if (run_tail)
+        run_tail->fiber_next = thread;
+    else
+        run_head = thread;
+    run_tail = thread;
+    InterlockedIncrement(&run_count);
+    ReleaseSRWLockExclusive(&run_lock);
+
+    WakeByAddressSingle((PVOID)&run_count);
+}
+
+static slim_pthread_t run_pop(void)
+{
+    slim_pthread_t thread;
+
+    if (!run_count)
+        return NULL;
+
+    AcquireSRWLockExclusive(&run_lock);
+    thread = run_head;
+    if (thread) {
+        run_head = thread->fiber_next;
+        if (!run_head)
+            run_tail = NULL;
+        InterlockedDecrement(&run_count);
+    }
+    ReleaseSRWLockExclusive(&run_lock);
+
+    return thread;
+}
+
+static slim_pthread_wait_bucket_t *wait_bucket(volatile void *address)
+{
+    uintptr_t key = (uintptr_t)address;
+
+    return &buckets[((key >> 3) ^ (key >> 11)) % WAIT_BUCKETS];
+}
+
+static void bucket_link(slim_pthread_wait_bucket_t *bucket,
+        slim_pthread_waiter_t *waiter)
+{
+    waiter->prev = bucket->tail;
+    waiter->next = NULL;
+    if (bucket->tail)
+        bucket->tail->next = waiter;
+    else
+        bucket->head = waiter;
+    bucket->tail = waiter;
+    waiter->queued = true;
+
+    InterlockedIncrement(&fiber_waiters);
+}
+
+static void bucket_unlink(slim_pthread_wait_bucket_t *bucket,
+        slim_pthread_waiter_t *waiter)
+{
+    if (waiter->prev)
+        waiter->prev->next = waiter->next;
+    else
+        bucket->head = waiter->next;
+
+    if (waiter->next)
+        waiter->next->prev = waiter->prev;
+    else
+        bucket->tail = waiter->prev;
+    waiter->queued = false;
+
+    InterlockedDecrement(&fiber_waiters);
+}
+
+static void timer_link(slim_pthread_waiter_t *waiter)
+{
+    AcquireSRWLockExclusive(&timer_lock);
+    waiter->timer_prev = NULL;
+    waiter->timer_next = timer_head;
+    if (timer_head)
+        timer_head->timer_prev = waiter;
+    timer_head = waiter;
+    waiter->timer_linked = true;
+
+    if (waiter->deadline < timer_next)
+        timer_next = waiter->deadline;
+    ReleaseSRWLockExclusive(&timer_lock);
+}
+
+// Called with timer_lock held.
+static void timer_unlink(slim_pthread_waiter_t *waiter)
+{
+    if (waiter->timer_prev)
+        waiter->timer_prev->timer_next = waiter->timer_next;
+    else
+        timer_head = waiter->timer_next;
+
+    if (waiter->timer_next)
+        waiter->timer_next->timer_prev = waiter->timer_prev;
+    waiter->timer_linked = false;
+}
+
+// Makes the fibers whose deadline passed ready. Returns true if any was.
+static bool timers_expire(void)
+{
+    slim_pthread_waiter_t *waiter, *next;
+    ULONGLONG now;
+    bool expired = false;
+
+    if (!timer_head)
+        return false;
+
+    now = GetTickCount64();
+
+    AcquireSRWLockExclusive(&timer_lock);
+    if (now >= timer_next) {
+        timer_next = ULLONG_MAX;
+
+        for (waiter = timer_head; waiter; waiter = next) {
+            next = waiter->timer_next;
+
+            if (waiter->deadline > now) {
+                if (waiter->deadline < timer_next)
+                    timer_next = waiter->deadline;
+                continue;
+            }
+
+            timer_unlink(waiter);
+            if (InterlockedCompareExchange(&waiter->state, WAITER_TIMEDOUT,
+                    WAITER_WAITING) == WAITER_WAITING) {
+                run_push(waiter->thread);
+                expired = true;
+            }
+        }
+    }
+    ReleaseSRWLockExclusive(&timer_lock);
+
+    return expired;
+}
+
+static DWORD timers_wait_ms(void)
+{
+    ULONGLONG next, now;
+
+    if (!timer_head)
+        return INFINITE;
+
+    AcquireSRWLockShared(&timer_lock);
+    next = timer_next;
+    ReleaseSRWLockShared(&timer_lock);
+
+    now = GetTickCount64();
+    if (next <= now)
+        return 0;
+
+    return next - now < INFINITE ? (DWORD)(next - now) : INFINITE - 1;
+}
+
+// Switches the running fiber back to its carrier, which completes
+// 'action' once the fiber is off its stack.
+static void fiber_suspend(slim_pthread_t thread, int action, SRWLOCK *lock,
+        slim_pthread_waiter_t *waiter)
+{
+    slim_pthread_carrier_t *carrier = thread->carrier;
+
+    carrier->action = action;
+    carrier->action_lock = lock;
+    carrier->action_waiter = waiter;
+    carrier->action_thread = thread;
+    SwitchToFiber(carrier->fiber);
+}
+
+static void carrier_complete(slim_pthread_carrier_t *carrier)
+{
+    slim_pthread_t thread = carrier->action_thread;
+
+    switch (carrier->action) {
+    case ACTION_PARK:
+        if (carrier->action_waiter->timed)
+            timer_link(carrier->action_waiter);
+        ReleaseSRWLockExclusive(carrier->action_lock);
+        break;
+
+    case ACTION_EXIT:
+        DeleteFiber(thread->fiber);
+
+        if (!slim_pthread_mark_exited(thread))
+            slim_pthread_free(thread);
+        break;
+    }
+
+    carrier->action = ACTION_NONE;
+}
+
+// Lets an idle carrier exit when pthread_setconcurrency() lowered the
+// level. The last carrier never leaves.
+static bool carrier_retire(void)
+{
+    long count = carrier_count;
+
+    while (count > carrier_target && count > 1) {
+        if (InterlockedCompareExchange(&carrier_count, count - 1,
+                count) == count)
+            return true;
+        count = carrier_count;
+    }
+
+    return false;
+}
+
+static unsigned int __stdcall carrier_main(void *arg)
+{
+    slim_pthread_carrier_t carrier = {NULL, ACTION_NONE, NULL, NULL, NULL};
+    slim_pthread_t thread;
+    long none = 0;
+
+    carrier.fiber = ConvertThreadToFiberEx(&carrier, FIBER_FLAG_FLOAT_SWITCH);
+    if (!carrier.fiber) {
+        InterlockedDecrement(&carrier_count);
+        return 0;
+    }
+
+    for (;;) {
+        timers_expire();
+
+        thread = run_pop();
+        if (!thread) {
+            if (carrier_retire())
+                break;
+
+            WaitOnAddress(&run_count, &none, sizeof(none), timers_wait_ms());
+            continue;
+        }
+
+        thread->carrier = &carrier;
+        slim_pthread_set_self(thread);
+        SwitchToFiber(thread->fiber);
+        slim_pthread_set_self(NULL);
+
+        carrier_complete(&carrier);
+    }
+
+    ConvertFiberToThread();
+    return 0;
+}
+
+static long carriers_wanted(int level)
+{
+    if (level > 0)
+        return level;
+
+    return (long)GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+}
+
+// Called with carriers_lock held.
+static int carriers_grow(void)
+{
+    HANDLE handle;
+
+    while (carrier_count < carrier_target) {
+        handle = (HANDLE)_beginthreadex(NULL, 0, carrier_main, NULL, 0, NULL);
+        if (!handle)
+            return carrier_count ? 0 : EAGAIN;
+
+        CloseHandle(handle);
+        InterlockedIncrement(&carrier_count);
+    }
+
+    return 0;
+}
+
+void slim_pthread_carriers_resize(int level)
+{
+    AcquireSRWLockExclusive(&carriers_lock);
+    carrier_target = carriers_wanted(level);
+    if (carriers_started)
+        carriers_grow();
+    ReleaseSRWLockExclusive(&carriers_lock);
+
+    // Idle carriers above the new level retire when they wake up.
+    WakeByAddressAll((PVOID)&run_count);
+}
+
+static void WINAPI fiber_start(void *arg)
+{
+    slim_pthread_t thread = (slim_pthread_t)arg;
+
+    if (slim_pthread_batch_wait(thread))
+        thread->exit_value_ptr = thread->start_routine(thread->start_arg);
+
+    slim_pthread_fiber_exit();
+}
+
+int slim_pthread_fiber_create(slim_pthread_t thread)
+{
+    SIZE_T reserve, commit;
+    int rc = 0;
+
+    if (!slim_pthread_self_slot_init())
+        return EAGAIN;
+
+    if (!carriers_started) {
+        AcquireSRWLockExclusive(&carriers_lock);
+        if (!carriers_started) {
+            if (!carrier_target)
+                carrier_target = carriers_wanted(0);
+
+            rc = carriers_grow();
+            if (rc == 0)
+                carriers_started = true;
+        }
+        ReleaseSRWLockExclusive(&carriers_lock);
+
+        if (rc != 0)
+            return rc;
+    }
+
+    reserve = thread->stacksize ? thread->stacksize : FIBER_STACK_DEFAULT;
+    commit = thread->stackpolicy == PTHREAD_STACK_COMMIT_NP ? reserve : 0;
+
+    thread->fiber = CreateFiberEx(commit, reserve, FIBER_FLAG_FLOAT_SWITCH,
+            fiber_start, thread);
+    if (!thread->fiber)
+        return EAGAIN;
+
+    run_push(thread);
+    return 0;
+}
+
+void slim_pthread_fiber_exit(void)
+{
+    slim_pthread_t thread = slim_pthread_fiber_self();
+
+    slim_pthread_cleanup();
+
+    // The carrier deletes the fiber and releases the descriptor.
+    fiber_suspend(thread, ACTION_EXIT, NULL, NULL);
+}
+
+/*
+ * WaitOnAddress() for library objects. A fiber parks in the wait table
+ * and lets its carrier run other fibers instead. Returns false only when
+ * the time ran out, wakeups may be spurious.
+ */
+bool slim_pthread_wait(volatile void *address, void *compare, size_t size,
+        DWORD milliseconds)
+{
+    slim_pthread_t thread = slim_pthread_fiber_self();
+    slim_pthread_wait_bucket_t *bucket;
+    slim_pthread_waiter_t waiter;
+
+    if (!thread) {
+        if (WaitOnAddress(address, compare, size, milliseconds))
+            return true;
+
+        return GetLastError() != ERROR_TIMEOUT;
+    }
+
+    waiter.address = address;
+    waiter.thread = thread;
+    waiter.state = WAITER_WAITING;
+    waiter.timed = milliseconds != INFINITE;
+    waiter.timer_linked = false;
+    waiter.deadline = waiter.timed ? GetTickCount64() + milliseconds : 0;
+
+    bucket = wait_bucket(address);
+    AcquireSRWLockExclusive(&bucket->lock);
+    bucket_link(bucket, &waiter);
+
+    // Wakers change the value before looking for waiters, so checking it
+    // once queued cannot miss a wakeup.
+    if (memcmp((const void *)address, compare, size) != 0) {
+        bucket_unlink(bucket, &waiter);
+        ReleaseSRWLockExclusive(&bucket->lock);
+        return true;
+    }
+
+    fiber_suspend(thread, ACTION_PARK, &bucket->lock, &waiter);
+
+    if (waiter.timer_linked) {
+        AcquireSRWLockExclusive(&timer_lock);
+        if (waiter.timer_linked)
+            timer_unlink(&waiter);
+        ReleaseSRWLockExclusive(&timer_lock);
+    }
+
+    if (waiter.queued) {
+        AcquireSRWLockExclusive(&bucket->lock);
+        if (waiter.queued)
+            bucket_unlink(bucket, &waiter);
+        ReleaseSRWLockExclusive(&bucket->lock);
+    }
+
+    return waiter.state == WAITER_WOKEN;
+}
+
+void slim_pthread_wake(volatile void *address, bool all)
+{
+    slim_pthread_wait_bucket_t *bucket;
+    slim_pthread_waiter_t *waiter, *next;
+    bool woken = false;
+
+    if (fiber_waiters) {
+        bucket = wait_bucket(address);
+
+        AcquireSRWLockExclusive(&bucket->lock);
+        for (waiter = bucket->head; waiter; waiter = next) {
+            next = waiter->next;
+
+            if (waiter->address != address ||
+                    InterlockedCompareExchange(&waiter->state, WAITER_WOKEN,
+                    WAITER_WAITING) != WAITER_WAITING)
+                continue;
+
+            bucket_unlink(bucket, waiter);
+            run_push(waiter->thread);
+            woken = true;
+
+            if (!all)
+                break;
+        }
+        ReleaseSRWLockExclusive(&bucket->lock);
+    }
+
+    if (all)
+        WakeByAddressAll((PVOID)address);
+    else if (!woken)
+        WakeByAddressSingle((PVOID)address);
+}
@@ -44,10 +44,9 @@ extern "C" {
 #define _PTHREAD_ATTR_INIT              0x73707461
 
 #define _PTHREAD_BARRIER_INIT           0x73706272
+#define _PTHREAD_PHASER_INIT            0x73707068
 #define _PTHREAD_INIT                   0x73707468
 
-#define _PTHREAD_KEY_INIT               0x73706B79
-
 typedef struct _slim_pthread_mutexattr_t {
     int sig;
     int prioceiling;
@@ -56,47 +55,167 @@ typedef struct _slim_pthread_mutexattr_t {
     int type;
 } slim_pthread_mutexattr_t;
 
+/*
+ * owner is the slim_pthread_owner() of the holder and count its depth.
+ * fibers counts process scope threads waiting for lock, which park on seq.
+ */
 typedef struct _slim_pthread_mutex_t {
     int sig;
     long state;
     int prioceiling;
-    CRITICAL_SECTION cs;
+    SRWLOCK lock;
+    uintptr_t owner;
+    unsigned int count;
+    volatile long fibers;
+    volatile long seq;
 } slim_pthread_mutex_t;
 
 typedef struct _slim_pthread_rwlockattr_t {
     int sig;
     int shared;
+    int stats;
 } slim_pthread_rwlockattr_t;
 
+typedef struct _slim_pthread_rwlock_stats_t {
+    pthread_rwlock_t *lock;
+    volatile long readers;
+    LONG64 wrstart;
+    struct pthread_rwlock_stats_np counters;
+    struct _slim_pthread_rwlock_stats_t *prev;
+    struct _slim_pthread_rwlock_stats_t *next;
+} slim_pthread_rwlock_stats_t;
+
 typedef struct _slim_pthread_rwlock_t {
     int sig;
     int state;
+    int shared;
     DWORD rwstate;
     SRWLOCK srwlock;
+    SRWLOCK uplock;
+    slim_pthread_rwlock_stats_t *stats;
 } slim_pthread_rwlock_t;
 
+/*
+ * Process shared variants live in the same public objects and share the
+ * sig/state/shared prefix with the private layouts. Everything past the
+ * prefix must make sense in any process mapping the object, so they only
+ * hold plain words plus the (pid, serial) pair naming their semaphores.
+ */
+typedef struct _slim_pthread_shared_rwlock_t {
+    int sig;
+    int state;
+    int shared;
+    volatile long status;
+    DWORD pid;
+    DWORD serial;
+} slim_pthread_shared_rwlock_t;
+
+typedef struct _slim_pthread_seqlock_t {
+    int sig;
+    volatile long seq;
+    SRWLOCK writelock;
+} slim_pthread_seqlock_t;
+
 typedef struct _slim_pthread_condattr_t {
     int sig;
     int shared;
 } slim_pthread_condattr_t;
 
+/*
+ * System scope waiters sleep on condvar under lock and are counted in
+ * sleepers, process scope waiters park on seq and are counted in fibers.
+ */
 typedef struct _slim_pthread_cond_t {
     int sig;
     int state;
+    SRWLOCK lock;
     CONDITION_VARIABLE condvar;
+    volatile long sleepers;
+    volatile long fibers;
+    volatile long seq;
 } slim_pthread_cond_t;
 
 typedef struct _slim_pthread_barrierattr_t {
     int sig;
     int shared;
+    int spin;
+    int type;
+    size_t reduce_size;
+    void (*reduce)(void *, const void *);
+    void (*completion)(void *, void *);
+    void *completion_arg;
 } slim_pthread_barrierattr_t;
 
+/*
+ * Tree barrier node, one per cache line. 'arrived' holds the generation
+ * being counted in its upper bits and the arrivals so far in the lower
+ * ones, so a node left full by the previous phase reads as empty.
+ */
+#define BARRIER_CACHE_LINE              64
+#define BARRIER_ARRIVED_BITS            8
+#define BARRIER_ARRIVED_MASK            0xFF
+
+typedef struct _slim_pthread_barrier_node_t {
+    volatile long arrived;
+    volatile long release;
+    long expected;
+    long parent;
+    char padding[BARRIER_CACHE_LINE - 4 * sizeof(long)];
+} slim_pthread_barrier_node_t;
+
+/*
+ * Reduction and completion state of a barrier. Each arrival owns a slot
+ * for the phase, a value followed by the generation + 1 it was written in.
+ */
+#define BARRIER_SLOT_VALUE              16
+
+typedef struct _slim_pthread_barrier_slot_t {
+    volatile long ready;
+    long filled;
+} slim_pthread_barrier_slot_t;
+
+typedef struct _slim_pthread_barrier_reduce_t {
+    size_t size;
+    size_t stride;
+    void (*reduce)(void *, const void *);
+    void (*completion)(void *, void *);
+    void *completion_arg;
+    char *slots;
+    char *result;
+} slim_pthread_barrier_reduce_t;
+
 typedef struct _slim_pthread_barrier_t {
     int sig;
     int state;
-    SYNCHRONIZATION_BARRIER syncbar;
+    int shared;
+    unsigned int count;
+    volatile long remaining;
+    volatile long generation;
+    unsigned int spin;
+    int type;
+    unsigned int leaves;
+    volatile long inside;
+    slim_pthread_barrier_node_t *nodes;
+    slim_pthread_barrier_reduce_t *reduce;
 } slim_pthread_barrier_t;
 
+typedef struct _slim_pthread_shared_barrier_t {
+    int sig;
+    int state;
+    int shared;
+    unsigned int count;
+    volatile long remaining;
+    volatile long generation;
+    DWORD pid;
+    DWORD serial;
+} slim_pthread_shared_barrier_t;
+
+typedef struct _slim_pthread_phaser_t {
+    int sig;
+    unsigned int spin;
+    volatile LONG64 state;
+} slim_pthread_phaser_t;
+
 typedef struct _slim_pthread_attr_t {
     int sig;
     void *stackaddr;
@@ -107,26 +226,83 @@ typedef struct _slim_pthread_attr_t {
     int schedpolicy;
     int schedpriority;
     int contentionscope;
+    int stackpolicy;
+    int numanode;
+    bool has_cpuset;
+    cpu_set_t cpuset;
 } slim_pthread_attr_t;
 
+/*
+ * Who releases a thread descriptor: its joiner, the thread itself when
+ * detached, or, once exited, whichever of pthread_join() and
+ * pthread_detach() comes next. Changed with compare exchange only.
+ */
+#define THREAD_JOINABLE                 0
+#define THREAD_DETACHED                 1
+#define THREAD_EXITED                   2
+
 typedef struct _slim_pthread_t {
     int sig;
     struct __slim_pthread_cleanup_handler *cleanup_stack;
-    HANDLE handle;
+    unsigned int specific_size;
+    struct __slim_pthread_specific *specific;
+    unsigned int specific_count;
+    unsigned int specific_capacity;
+    unsigned int *specific_used;
+    unsigned int static_count;
+    unsigned int static_capacity;
+    const pthread_static_key_np **static_keys;
+    size_t stacksize;
+    size_t guardsize;
+    int stackpolicy;
+    bool affinity;
+    void *fiber;
+    struct _slim_pthread_carrier_t *carrier;
+    struct _slim_pthread_t *fiber_next;
+    struct _slim_pthread_batch_t *batch;
+    HANDLE volatile handle;
     DWORD id;
-    bool detached;
+    volatile long joinstate;
     int cancelstate;
     int canceltype;
     bool canceled;
     int schedpolicy;
     int schedpriority;
-    int concurrency;
     bool normal_exit;
+    volatile long setup;
     void *(*start_routine)(void *);
     void *start_arg;
     void *exit_value_ptr;
 } *slim_pthread_t;
 
+/*
+ * Shared allocation of the descriptors made by one
+ * pthread_create_batch_np(), freed with the last of them. start gates the
+ * threads of a synchronized batch.
+ */
+#define BATCH_WAIT                      0
+#define BATCH_GO                        1
+#define BATCH_ABORT                     2
+
+typedef struct _slim_pthread_batch_t {
+    volatile long refs;
+    volatile long start;
+} slim_pthread_batch_t;
+
+/*
+ * A cached OS thread, living on its own stack while parked. thread is the
+ * next descriptor to run, set by pthread_create() under the cache lock.
+ */
+typedef struct _slim_pthread_worker_t {
+    slim_pthread_t volatile thread;
+    HANDLE handle;
+    DWORD id;
+    size_t stacksize;
+    size_t guardsize;
+    int stackpolicy;
+    struct _slim_pthread_worker_t *next;
+} slim_pthread_worker_t;
+
 static_assert(sizeof(pthread_mutexattr_t) >= sizeof(slim_pthread_mutexattr_t),
               "Size of pthread mutex attr miss match");
 
@@ -139,6 +315,12 @@ static_assert(sizeof(pthread_rwlockattr_t) >= sizeof(slim_pthread_rwlockattr_t),
 static_assert(sizeof(pthread_rwlock_t) >= sizeof(slim_pthread_rwlock_t),
               "Size of pthread rwlock miss match");
 
+static_assert(sizeof(pthread_rwlock_t) >= sizeof(slim_pthread_shared_rwlock_t),
+              "Size of pthread shared rwlock miss match");
+
+static_assert(sizeof(pthread_seqlock_t) >= sizeof(slim_pthread_seqlock_t),
+              "Size of pthread seqlock miss match");
+
 static_assert(sizeof(pthread_condattr_t) >= sizeof(slim_pthread_condattr_t),
               "Size of pthread cond attr miss match");
 
@@ -151,22 +333,81 @@ static_assert(sizeof(pthread_barrierattr_t) >= sizeof(slim_pthread_barrierattr_t
 static_assert(sizeof(pthread_barrier_t) >= sizeof(slim_pthread_barrier_t),
               "Size of pthread barrier miss match");
 
+static_assert(sizeof(pthread_barrier_t) >= sizeof(slim_pthread_shared_barrier_t),
+              "Size of pthread shared barrier miss match");
+
+static_assert(sizeof(pthread_phaser_t) >= sizeof(slim_pthread_phaser_t),
+              "Size of pthread phaser miss match");
+
 static_assert(sizeof(pthread_attr_t) >= sizeof(slim_pthread_attr_t),
               "Size of pthread attr miss match");
 
 static_assert(sizeof(struct opaque_pthread_t) >= sizeof(struct _slim_pthread_t),
               "Size of pthread miss match");
 
-typedef struct __slim_pthread_key_t {
-    int sig;
-    DWORD slot;
+/*
+ * Registry entry of a key index. key is the live key using the index, or
+ * 0 while the index sits on the free list.
+ */
+typedef struct _slim_pthread_key_t {
+    volatile long key;
+    unsigned int generation;
     void (* destructor)(void *);
-    struct __slim_pthread_key_t *prev;
-    struct __slim_pthread_key_t *next;
+    unsigned int next_free;
 } slim_pthread_key_t;
 
 void slim_pthread_cleanup(void);
-void slim_pthread_keys_cleanup(void);
+bool slim_pthread_self_slot_init(void);
+void slim_pthread_set_self(slim_pthread_t thread);
+void slim_pthread_free(slim_pthread_t thread);
+bool slim_pthread_mark_exited(slim_pthread_t thread);
+bool slim_pthread_batch_wait(slim_pthread_t thread);
+void slim_pthread_keys_cleanup(slim_pthread_t thread);
+void slim_pthread_rcu_cleanup(void);
+
+HANDLE slim_pthread_handle(slim_pthread_t thread);
+bool slim_pthread_affinity_valid(const cpu_set_t *cpuset);
+int slim_pthread_affinity_apply(HANDLE handle, const cpu_set_t *cpuset);
+bool slim_pthread_numa_placed(int node);
+int slim_pthread_numa_apply(HANDLE handle, int node);
+
+slim_pthread_t slim_pthread_fiber_self(void);
+int slim_pthread_fiber_create(slim_pthread_t thread);
+void slim_pthread_fiber_exit(void);
+void slim_pthread_carriers_resize(int level);
+uintptr_t slim_pthread_owner(void);
+bool slim_pthread_wait(volatile void *address, void *compare, size_t size,
+        DWORD milliseconds);
+void slim_pthread_wake(volatile void *address, bool all);
+
+DWORD slim_pthread_abstime_ms(const struct timespec *abstime);
+
+unsigned int slim_pthread_mutex_release(slim_pthread_mutex_t *mutex);
+void slim_pthread_mutex_acquire(slim_pthread_mutex_t *mutex,
+        unsigned int count);
+
+int slim_pthread_rwlock_stats_init(slim_pthread_rwlock_t *lock,
+        const slim_pthread_rwlockattr_t *attr);
+void slim_pthread_rwlock_stats_destroy(slim_pthread_rwlock_t *lock);
+LONG64 slim_pthread_rwlock_stats_now(void);
+void slim_pthread_rwlock_stats_read(slim_pthread_rwlock_stats_t *stats,
+        bool contended);
+void slim_pthread_rwlock_stats_read_release(slim_pthread_rwlock_stats_t *stats);
+void slim_pthread_rwlock_stats_write(slim_pthread_rwlock_stats_t *stats,
+        bool contended, LONG64 start);
+void slim_pthread_rwlock_stats_write_release(slim_pthread_rwlock_stats_t *stats);
+
+int slim_pthread_shared_rwlock_init(slim_pthread_shared_rwlock_t *lock);
+int slim_pthread_shared_rwlock_rdlock(slim_pthread_shared_rwlock_t *lock,
+        bool trylock);
+int slim_pthread_shared_rwlock_wrlock(slim_pthread_shared_rwlock_t *lock,
+        bool trylock);
+int slim_pthread_shared_rwlock_unlock(slim_pthread_shared_rwlock_t *lock);
+int slim_pthread_shared_rwlock_downgrade(slim_pthread_shared_rwlock_t *lock);
+
+int slim_pthread_shared_barrier_init(slim_pthread_shared_barrier_t *barrier,
+        unsigned int count);
+int slim_pthread_shared_barrier_wait(slim_pthread_shared_barrier_t *barrier);
 
 #ifdef __cplusplus
 }
@@ -22,101 +22,364 @@
 
 #include <windows.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <assert.h>
 
 #include "pthread_impl.h"
 
-static slim_pthread_key_t keys = {0, TLS_OUT_OF_INDEXES, NULL, &keys, &keys};
+/*
+ * Keys index a registry that grows in fixed chunks, so entries never move
+ * and can be looked up without keys_lock. The lock only serializes key
+ * creation and deletion, exiting threads never take it.
+ */
+#define KEY_CHUNK_BITS                  8
+#define KEY_CHUNK_SIZE                  (1u << KEY_CHUNK_BITS)
+#define KEY_CHUNKS                      (PTHREAD_KEYS_MAX / KEY_CHUNK_SIZE)
+#define KEY_GENERATIONS                 (1u << (32 - __SLIM_PTHREAD_KEY_INDEX_BITS))
+#define KEY_NONE                        ((unsigned int)-1)
+
+#define KEY_INDEX(key)                  ((key) & __SLIM_PTHREAD_KEY_INDEX_MASK)
+
+#define SPECIFIC_MIN_SIZE               8
+
+static slim_pthread_key_t *volatile chunks[KEY_CHUNKS];
+static unsigned int keys_used = 0;
+static unsigned int keys_free = KEY_NONE;
 static pthread_mutex_t keys_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_key_t current = NULL;
+
+static slim_pthread_key_t *key_entry(unsigned int index)
+{
+    slim_pthread_key_t *chunk = chunks[index >> KEY_CHUNK_BITS];
+
+    if (!chunk)
+        return NULL;
+
+    return &chunk[index & (KEY_CHUNK_SIZE - 1)];
+}
+
+static slim_pthread_key_t *key_lookup(pthread_key_t key)
+{
+    slim_pthread_key_t *entry;
+
+    if (!key)
+        return NULL;
+
+    entry = key_entry(KEY_INDEX(key));
+    if (!entry || (pthread_key_t)entry->key != key)
+        return NULL;
+
+    return entry;
+}
+
+// Returns the destructor of a live key without holding keys_lock. The key
+// is read again after the destructor so that a concurrent delete and
+// re-create of the index cannot hand back another key's destructor.
+static bool key_destructor(pthread_key_t key, void (**destructor)(void *))
+{
+    slim_pthread_key_t *entry = key_lookup(key);
+
+    if (!entry)
+        return false;
+
+    __slim_pthread_acquire_fence();
+    *destructor = entry->destructor;
+    __slim_pthread_acquire_fence();
+
+    return (pthread_key_t)entry->key == key;
+}
 
 int pthread_key_create(pthread_key_t *key, void (*destructor)(void *))
 {
-    pthread_key_t new_key;
+    slim_pthread_key_t *entry;
+    unsigned int index;
 
     if (!key)
         return EINVAL;
 
-    new_key = (pthread_key_t)malloc(sizeof(slim_pthread_key_t));
-    if (!new_key)
-        return ENOMEM;
-
-    new_key->slot = TlsAlloc();
-    if (new_key->slot == TLS_OUT_OF_INDEXES) {
-        free((void *)new_key);
+    // The inline get/set need the descriptor slot of the calling thread.
+    if (!slim_pthread_self_slot_init())
         return EAGAIN;
+
+    pthread_mutex_lock(&keys_lock);
+
+    if (keys_free != KEY_NONE) {
+        index = keys_free;
+        entry = key_entry(index);
+        keys_free = entry->next_free;
+    } else {
+        if (keys_used == PTHREAD_KEYS_MAX) {
+            pthread_mutex_unlock(&keys_lock);
+            return EAGAIN;
+        }
+
+        index = keys_used;
+        if (!chunks[index >> KEY_CHUNK_BITS]) {
+            slim_pthread_key_t *chunk;
+
+            chunk = (slim_pthread_key_t *)calloc(KEY_CHUNK_SIZE,
+                    sizeof(slim_pthread_key_t));
+            if (!chunk) {
+                pthread_mutex_unlock(&keys_lock);
+                return ENOMEM;
+            }
+
+            InterlockedExchangePointer((PVOID volatile *)
+                    &chunks[index >> KEY_CHUNK_BITS], chunk);
+        }
+
+        keys_used++;
+        entry = key_entry(index);
     }
 
-    new_key->sig = _PTHREAD_KEY_INIT;
-    new_key->destructor = destructor;
+    // Generation 0 is skipped so that no key is ever 0. Indexes are
+    // retired before their generation wraps, see pthread_key_delete().
+    entry->generation++;
 
-    pthread_mutex_lock(&keys_lock);
-    new_key->prev = keys.prev;
-    new_key->next = &keys;
-    keys.prev->next = new_key;
-    keys.prev = new_key;
-    pthread_mutex_unlock(&keys_lock);
+    entry->destructor = destructor;
+    entry->next_free = KEY_NONE;
+    InterlockedExchange(&entry->key, (long)(index |
+            (entry->generation << __SLIM_PTHREAD_KEY_INDEX_BITS)));
 
-    *key = new_key;
+    *key = (pthread_key_t)entry->key;
+    pthread_mutex_unlock(&keys_lock);
     return 0;
 }
 
 int pthread_key_delete(pthread_key_t key)
 {
-    if (!key || key->sig != _PTHREAD_KEY_INIT ||
-            key->slot == TLS_OUT_OF_INDEXES)
-        return EINVAL;
+    slim_pthread_key_t *entry;
 
     pthread_mutex_lock(&keys_lock);
-    if (current == key)
-        current = key->prev;
 
-    key->prev->next = key->next;
-    key->next->prev = key->prev;
-    key->next = NULL;
-    key->prev = NULL;
-    pthread_mutex_unlock(&keys_lock);
+    entry = key_lookup(key);
+    if (!entry) {
+        pthread_mutex_unlock(&keys_lock);
+        return EINVAL;
+    }
+
+    // Values still held by threads keep the old generation and are
+    // ignored from now on.
+    InterlockedExchange(&entry->key, 0);
+
+    // Reusing the index past its last generation would bring old keys,
+    // and the values threads still hold for them, back to life. Retire
+    // it instead, which costs one index per 4095 deletions of it.
+    if (entry->generation < KEY_GENERATIONS - 1) {
+        entry->next_free = keys_free;
+        keys_free = KEY_INDEX(key);
+    }
 
-    TlsFree(key->slot);
-    memset(key, 0, sizeof(slim_pthread_key_t));
+    pthread_mutex_unlock(&keys_lock);
     return 0;
 }
 
 void* pthread_getspecific(pthread_key_t key)
 {
-    if (!key || key->sig != _PTHREAD_KEY_INIT ||
-            key->slot == TLS_OUT_OF_INDEXES)
-        return NULL;
+    slim_pthread_t thread;
+    unsigned int index = KEY_INDEX(key);
+
+    thread = (slim_pthread_t)TlsGetValue(__slim_pthread_self_slot);
+    if (thread && index < thread->specific_size &&
+            thread->specific[index].__key == key)
+        return thread->specific[index].__value;
 
-    return TlsGetValue(key->slot);
+    return NULL;
 }
 
 int pthread_setspecific(pthread_key_t key, const void *value)
 {
-    BOOL rc;
+    slim_pthread_t thread;
+    unsigned int index = KEY_INDEX(key);
+
+    thread = (slim_pthread_t)TlsGetValue(__slim_pthread_self_slot);
+    if (thread && index < thread->specific_size &&
+            thread->specific[index].__key == key) {
+        thread->specific[index].__value = (void *)value;
+        return 0;
+    }
+
+    return __slim_pthread_setspecific(key, value);
+}
+
+static int specific_grow(slim_pthread_t thread, unsigned int size)
+{
+    struct __slim_pthread_specific *specific;
+    unsigned int new_size;
+
+    new_size = thread->specific_size ? thread->specific_size : SPECIFIC_MIN_SIZE;
+    while (new_size < size)
+        new_size *= 2;
+
+    specific = (struct __slim_pthread_specific *)realloc(thread->specific,
+            new_size * sizeof(struct __slim_pthread_specific));
+    if (!specific)
+        return ENOMEM;
+
+    memset(specific + thread->specific_size, 0,
+            (new_size - thread->specific_size) *
+            sizeof(struct __slim_pthread_specific));
+
+    thread->specific = specific;
+    thread->specific_size = new_size;
+    return 0;
+}
+
+// Records that the thread has used the index, so that exit only visits
+// the entries it has ever set. Each index is recorded once, the first
+// time it gets a key.
+static int specific_use(slim_pthread_t thread, unsigned int index)
+{
+    if (thread->specific_count == thread->specific_capacity) {
+        unsigned int *used;
+        unsigned int capacity;
+
+        capacity = thread->specific_capacity ?
+                thread->specific_capacity * 2 : SPECIFIC_MIN_SIZE;
+        used = (unsigned int *)realloc(thread->specific_used,
+                capacity * sizeof(unsigned int));
+        if (!used)
+            return ENOMEM;
+
+        thread->specific_used = used;
+        thread->specific_capacity = capacity;
+    }
+
+    thread->specific_used[thread->specific_count++] = index;
+    return 0;
+}
+
+int __slim_pthread_static_key_use(const pthread_static_key_np *key)
+{
+    slim_pthread_t thread;
+
+    if (!key || !key->__slot)
+        return EINVAL;
+
+    thread = (slim_pthread_t)pthread_self();
+    if (!thread)
+        return ENOMEM;
+
+    // The slot is in the TLS of the carrier, shared with other fibers, so
+    // exit of this one must not run the destructor on it.
+    if (thread->fiber)
+        return ENOTSUP;
+
+    if (thread->static_count == thread->static_capacity) {
+        const pthread_static_key_np **keys;
+        unsigned int capacity;
+
+        capacity = thread->static_capacity ?
+                thread->static_capacity * 2 : SPECIFIC_MIN_SIZE;
+        keys = (const pthread_static_key_np **)realloc(
+                (void *)thread->static_keys,
+                capacity * sizeof(const pthread_static_key_np *));
+        if (!keys)
+            return ENOMEM;
+
+        thread->static_keys = keys;
+        thread->static_capacity = capacity;
+    }
+
+    thread->static_keys[thread->static_count++] = key;
+    key->__slot()->__used = 1;
+    return 0;
+}
+
+int __slim_pthread_setspecific(pthread_key_t key, const void *value)
+{
+    slim_pthread_t thread;
+    unsigned int index = KEY_INDEX(key);
+    int rc;
 
-    if (!key || key->sig != _PTHREAD_KEY_INIT ||
-            key->slot == TLS_OUT_OF_INDEXES)
+    if (!key_lookup(key))
         return EINVAL;
 
-    rc = TlsSetValue(key->slot, (LPVOID)value);
-    return rc ? 0 : EINVAL;
+    thread = (slim_pthread_t)pthread_self();
+    if (!thread)
+        return ENOMEM;
+
+    if (index >= thread->specific_size) {
+        // A NULL value is what get returns for missing entries anyway.
+        if (!value)
+            return 0;
+
+        rc = specific_grow(thread, index + 1);
+        if (rc != 0)
+            return rc;
+    }
+
+    if (!thread->specific[index].__key) {
+        rc = specific_use(thread, index);
+        if (rc != 0)
+            return rc;
+    }
+
+    thread->specific[index].__key = key;
+    thread->specific[index].__value = (void *)value;
+    return 0;
 }
 
-void slim_pthread_keys_cleanup(void)
+void slim_pthread_keys_cleanup(slim_pthread_t thread)
 {
-    pthread_mutex_lock(&keys_lock);
+    void (*destructor)(void *);
+    void *value;
+    unsigned int i, index;
+    int pass;
+    bool again = true;
+
+    // No library lock is held here, so destructors may take as long as
+    // they like without holding up other exiting threads or key creation.
+    // Destructors may set values and grow the arrays, so re-read them on
+    // every iteration.
+    for (pass = 0; again && pass < PTHREAD_DESTRUCTOR_ITERATIONS; pass++) {
+        again = false;
+
+        for (i = 0; i < thread->specific_count; i++) {
+            index = thread->specific_used[i];
+            value = thread->specific[index].__value;
+            if (!value)
+                continue;
 
-    for (current = keys.next; current != &keys; current = current->next) {
-        if (current->destructor) {
-            void *value = TlsGetValue(current->slot);
-            if (value) {
-                current->destructor(value);
+            thread->specific[index].__value = NULL;
+            if (key_destructor(thread->specific[index].__key, &destructor) &&
+                    destructor) {
+                destructor(value);
+                again = true;
+            }
+        }
+
+        for (i = 0; i < thread->static_count; i++) {
+            const pthread_static_key_np *key = thread->static_keys[i];
+            struct __slim_pthread_static_slot *slot = key->__slot();
+
+            if (!slot->__value)
+                continue;
+
+            value = slot->__value;
+            slot->__value = NULL;
+            if (key->__destructor) {
+                key->__destructor(value);
+                again = true;
             }
         }
     }
 
-    pthread_mutex_unlock(&keys_lock);
+    for (i = 0; i < thread->static_count; i++)
+        thread->static_keys[i]->__slot()->__used = 0;
+
+    free(thread->specific);
+    thread->specific = NULL;
+    thread->specific_size = 0;
+
+    free(thread->specific_used);
+    thread->specific_used = NULL;
+    thread->specific_count = 0;
+    thread->specific_capacity = 0;
+
+    free((void *)thread->static_keys);
+    thread->static_keys = NULL;
+    thread->static_count = 0;
+    thread->static_capacity = 0;
 }
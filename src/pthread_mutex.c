@@ -25,6 +25,64 @@
 
 #include "pthread_impl.h"
 
+// System scope threads block in the SRW lock, which spins before going to
+// the kernel. Process scope threads must not block their carrier, so they
+// only ever try the lock and park on seq between tries; everybody who
+// releases the lock explicitly bumps seq while fibers are waiting.
+static void mutex_acquire(slim_pthread_mutex_t *mutex, uintptr_t owner,
+        unsigned int count)
+{
+    long seq;
+
+    // See slim_pthread_owner(), only system scope threads have the low bit.
+    if (owner & 1) {
+        AcquireSRWLockExclusive(&mutex->lock);
+    } else if (!TryAcquireSRWLockExclusive(&mutex->lock)) {
+        InterlockedIncrement(&mutex->fibers);
+        for (;;) {
+            seq = mutex->seq;
+            if (TryAcquireSRWLockExclusive(&mutex->lock))
+                break;
+            slim_pthread_wait(&mutex->seq, &seq, sizeof(seq), INFINITE);
+        }
+        InterlockedDecrement(&mutex->fibers);
+    }
+
+    mutex->owner = owner;
+    mutex->count = count;
+}
+
+static void mutex_release(slim_pthread_mutex_t *mutex)
+{
+    mutex->owner = 0;
+    mutex->count = 0;
+    ReleaseSRWLockExclusive(&mutex->lock);
+
+    if (mutex->fibers) {
+        InterlockedIncrement(&mutex->seq);
+        slim_pthread_wake(&mutex->seq, false);
+    }
+}
+
+void slim_pthread_mutex_acquire(slim_pthread_mutex_t *mutex,
+        unsigned int count)
+{
+    mutex_acquire(mutex, slim_pthread_owner(), count);
+}
+
+// Fully releases a mutex held by the caller, returning the depth it was
+// held at, or 0 if the caller does not hold it.
+unsigned int slim_pthread_mutex_release(slim_pthread_mutex_t *mutex)
+{
+    unsigned int count = mutex->count;
+
+    if (mutex->owner != slim_pthread_owner())
+        return 0;
+
+    mutex_release(mutex);
+    return count;
+}
+
 int pthread_mutex_init(pthread_mutex_t *__mutex,
         const pthread_mutexattr_t *__attr)
 {
@@ -50,7 +108,11 @@ int pthread_mutex_init(pthread_mutex_t *__mutex,
             mutex->prioceiling = 0;
 
         mutex->sig = _PTHREAD_MUTEX_INIT;
-        InitializeCriticalSection(&mutex->cs);
+        InitializeSRWLock(&mutex->lock);
+        mutex->owner = 0;
+        mutex->count = 0;
+        mutex->fibers = 0;
+        mutex->seq = 0;
         mutex->state = INITIALIZED;
     }
     else {
@@ -64,14 +126,11 @@ int pthread_mutex_init(pthread_mutex_t *__mutex,
 int pthread_mutex_destroy(pthread_mutex_t *__mutex)
 {
     slim_pthread_mutex_t *mutex = (slim_pthread_mutex_t *)__mutex;
-    long rc;
 
     if (!mutex || mutex->sig != _PTHREAD_MUTEX_INIT)
         return EINVAL;
 
-    rc = InterlockedCompareExchange(&mutex->state, UNINITIALIZED, INITIALIZED);
-    if (rc == INITIALIZED)
-        DeleteCriticalSection(&mutex->cs);
+    InterlockedCompareExchange(&mutex->state, UNINITIALIZED, INITIALIZED);
 
     memset(mutex, 0, sizeof(pthread_mutex_t));
 
@@ -81,6 +140,7 @@ int pthread_mutex_destroy(pthread_mutex_t *__mutex)
 int pthread_mutex_lock(pthread_mutex_t *__mutex)
 {
     slim_pthread_mutex_t *mutex = (slim_pthread_mutex_t *)__mutex;
+    uintptr_t owner;
 
     if (!mutex || mutex->sig != _PTHREAD_MUTEX_INIT)
         return EINVAL;
@@ -91,14 +151,20 @@ int pthread_mutex_lock(pthread_mutex_t *__mutex)
             return rc;
     }
 
-    EnterCriticalSection(&mutex->cs);
+    owner = slim_pthread_owner();
+    if (mutex->owner == owner) {
+        mutex->count++;
+        return 0;
+    }
+
+    mutex_acquire(mutex, owner, 1);
     return 0;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t *__mutex)
 {
     slim_pthread_mutex_t *mutex = (slim_pthread_mutex_t *)__mutex;
-    BOOL rc;
+    uintptr_t owner;
 
     if (!mutex || mutex->sig != _PTHREAD_MUTEX_INIT)
         return EINVAL;
@@ -109,8 +175,18 @@ int pthread_mutex_trylock(pthread_mutex_t *__mutex)
             return rc;
     }
 
-    rc = TryEnterCriticalSection(&mutex->cs);
-    return rc ? 0 : EBUSY;
+    owner = slim_pthread_owner();
+    if (mutex->owner == owner) {
+        mutex->count++;
+        return 0;
+    }
+
+    if (!TryAcquireSRWLockExclusive(&mutex->lock))
+        return EBUSY;
+
+    mutex->owner = owner;
+    mutex->count = 1;
+    return 0;
 }
 
 int pthread_mutex_unlock(pthread_mutex_t *__mutex)
@@ -121,7 +197,14 @@ int pthread_mutex_unlock(pthread_mutex_t *__mutex)
             mutex->state != INITIALIZED)
         return EINVAL;
 
-    LeaveCriticalSection(&mutex->cs);
+    // Like LeaveCriticalSection(), the depth is not checked against the
+    // caller, only a mutex nobody holds is refused.
+    if (mutex->count == 0)
+        return EPERM;
+
+    if (--mutex->count == 0)
+        mutex_release(mutex);
+
     return 0;
 }
 
@@ -36,14 +36,27 @@ BOOL CALLBACK init_wrapper(PINIT_ONCE InitOnce, PVOID Parameter, PVOID *lpContex
     return TRUE;
 }
 
-int pthread_once(pthread_once_t *once_control, void(*init_routine)(void))
+int __slim_pthread_once(pthread_once_t *once_control,
+        void(*init_routine)(void))
 {
     BOOL rc;
 
     if (!once_control || !init_routine)
         return EINVAL;
 
-    rc = InitOnceExecuteOnce(once_control, init_wrapper, init_routine, NULL);
+    rc = InitOnceExecuteOnce(&once_control->__once, init_wrapper,
+            init_routine, NULL);
     assert(rc == TRUE);
+
+    // Publish completion for the inline fast path in pthread.h.
+    InterlockedExchange(&once_control->__done, 1);
     return 0;
 }
+
+int pthread_once(pthread_once_t *once_control, void(*init_routine)(void))
+{
+    if (once_control && once_control->__done)
+        return 0;
+
+    return __slim_pthread_once(once_control, init_routine);
+}
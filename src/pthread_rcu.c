@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <windows.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "pthread_impl.h"
+
+/*
+ * Every thread that enters a read-side critical section registers a reader
+ * record, found through its TLS. Entering a section copies the global epoch
+ * into the record, leaving it stores zero; only the owning thread writes
+ * the record. A grace period advances the global epoch and waits until no
+ * record still shows an older one.
+ *
+ * Readers issue no memory barrier. Instead the writer calls
+ * FlushProcessWriteBuffers() around the scan, which serializes every
+ * processor running a reader, so a reader's epoch store is visible before
+ * its loads of the protected data can be, and its loads are complete
+ * before its store of zero is observed.
+ *
+ * Records are heap allocated so that they outlive their thread. An exiting
+ * thread only marks its record dead, and the next grace period unlinks and
+ * frees it. Grace periods are serialized, so a record cannot go away while
+ * a writer waits on it, and readers_lock is only ever held for list
+ * updates, never across a wait.
+ */
+
+#define RCU_CALLBACK_BATCH              64
+#define RCU_SPIN_COUNT                  1000
+
+typedef struct __slim_pthread_rcu_reader_t {
+    volatile long epoch;
+    long nesting;
+    volatile bool dead;
+    struct __slim_pthread_rcu_reader_t *prev;
+    struct __slim_pthread_rcu_reader_t *next;
+} slim_pthread_rcu_reader_t;
+
+typedef struct __slim_pthread_rcu_callback_t {
+    void (*func)(void *);
+    void *arg;
+    struct __slim_pthread_rcu_callback_t *next;
+} slim_pthread_rcu_callback_t;
+
+static __declspec(thread) slim_pthread_rcu_reader_t *reader = NULL;
+
+static volatile long rcu_epoch = 1;
+static slim_pthread_rcu_reader_t readers = {0, 0, false, &readers, &readers};
+static SRWLOCK readers_lock = SRWLOCK_INIT;
+static SRWLOCK grace_period_lock = SRWLOCK_INIT;
+
+static slim_pthread_rcu_callback_t *callbacks = NULL;
+static unsigned int callbacks_count = 0;
+static SRWLOCK callbacks_lock = SRWLOCK_INIT;
+
+static slim_pthread_rcu_reader_t *rcu_register(void)
+{
+    slim_pthread_rcu_reader_t *rec;
+
+    rec = (slim_pthread_rcu_reader_t *)calloc(1,
+            sizeof(slim_pthread_rcu_reader_t));
+    if (!rec)
+        return NULL;
+
+    AcquireSRWLockExclusive(&readers_lock);
+    rec->prev = readers.prev;
+    rec->next = &readers;
+    readers.prev->next = rec;
+    readers.prev = rec;
+    ReleaseSRWLockExclusive(&readers_lock);
+
+    reader = rec;
+    return rec;
+}
+
+void slim_pthread_rcu_cleanup(void)
+{
+    slim_pthread_rcu_reader_t *rec = reader;
+
+    if (!rec)
+        return;
+
+    // An exiting thread can never finish its read section, so drop it
+    // from the scan rather than stall every later grace period. The
+    // record is freed by the next one.
+    reader = NULL;
+    rec->epoch = 0;
+    rec->dead = true;
+}
+
+void pthread_rcu_read_lock_np(void)
+{
+    slim_pthread_rcu_reader_t *rec = reader;
+
+    if (!rec && (rec = rcu_register()) == NULL)
+        abort(); // Read sections have no way to report failure.
+
+    if (rec->nesting++ == 0) {
+        rec->epoch = rcu_epoch;
+        _ReadWriteBarrier();
+    }
+}
+
+void pthread_rcu_read_unlock_np(void)
+{
+    slim_pthread_rcu_reader_t *rec = reader;
+
+    assert(rec && rec->nesting > 0);
+
+    if (--rec->nesting == 0) {
+        _ReadWriteBarrier();
+        rec->epoch = 0;
+    }
+}
+
+static void rcu_wait_reader(slim_pthread_rcu_reader_t *rec, long epoch)
+{
+    unsigned int spin = 0;
+
+    for (;;) {
+        long seen = rec->epoch;
+
+        // Zero is quiescent, anything not older than 'epoch' entered its
+        // section after the new epoch was published.
+        if (seen == 0 || seen - epoch >= 0)
+            return;
+
+        if (++spin < RCU_SPIN_COUNT)
+            YieldProcessor();
+        else
+            Sleep(spin < RCU_SPIN_COUNT * 2 ? 0 : 1);
+    }
+}
+
+// Next record after rec, unlinking and freeing rec if its thread exited.
+// Called with grace_period_lock held, which keeps rec alive.
+static slim_pthread_rcu_reader_t *rcu_next(slim_pthread_rcu_reader_t *rec)
+{
+    slim_pthread_rcu_reader_t *next;
+
+    if (rec != &readers && rec->dead) {
+        AcquireSRWLockExclusive(&readers_lock);
+        next = rec->next;
+        rec->prev->next = rec->next;
+        rec->next->prev = rec->prev;
+        ReleaseSRWLockExclusive(&readers_lock);
+
+        free(rec);
+        return next;
+    }
+
+    AcquireSRWLockShared(&readers_lock);
+    next = rec->next;
+    ReleaseSRWLockShared(&readers_lock);
+
+    return next;
+}
+
+int pthread_rcu_synchronize_np(void)
+{
+    slim_pthread_rcu_reader_t *rec;
+    long epoch;
+
+    if (reader && reader->nesting)
+        return EDEADLK;
+
+    AcquireSRWLockExclusive(&grace_period_lock);
+
+    epoch = InterlockedIncrement(&rcu_epoch);
+    if (epoch == 0)
+        epoch = InterlockedIncrement(&rcu_epoch);
+
+    FlushProcessWriteBuffers();
+
+    // Records added meanwhile entered their sections in the new epoch.
+    for (rec = rcu_next(&readers); rec != &readers; rec = rcu_next(rec))
+        rcu_wait_reader(rec, epoch);
+
+    FlushProcessWriteBuffers();
+
+    ReleaseSRWLockExclusive(&grace_period_lock);
+    return 0;
+}
+
+int pthread_rcu_barrier_np(void)
+{
+    slim_pthread_rcu_callback_t *list, *next, *ordered = NULL;
+
+    // Waiting for a grace period from inside a read section never ends.
+    if (reader && reader->nesting)
+        return EDEADLK;
+
+    AcquireSRWLockExclusive(&callbacks_lock);
+    list = callbacks;
+    callbacks = NULL;
+    callbacks_count = 0;
+    ReleaseSRWLockExclusive(&callbacks_lock);
+
+    pthread_rcu_synchronize_np();
+
+    // Callbacks were pushed LIFO, run them in the order they were queued.
+    while (list) {
+        next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    while (ordered) {
+        next = ordered->next;
+        ordered->func(ordered->arg);
+        free(ordered);
+        ordered = next;
+    }
+
+    return 0;
+}
+
+int pthread_rcu_call_np(void (*func)(void *), void *arg)
+{
+    slim_pthread_rcu_callback_t *cb;
+    bool flush;
+
+    if (!func)
+        return EINVAL;
+
+    cb = (slim_pthread_rcu_callback_t *)malloc(
+            sizeof(slim_pthread_rcu_callback_t));
+    if (!cb)
+        return ENOMEM;
+
+    cb->func = func;
+    cb->arg = arg;
+
+    AcquireSRWLockExclusive(&callbacks_lock);
+    cb->next = callbacks;
+    callbacks = cb;
+    flush = (++callbacks_count >= RCU_CALLBACK_BATCH);
+    ReleaseSRWLockExclusive(&callbacks_lock);
+
+    if (flush && !(reader && reader->nesting))
+        pthread_rcu_barrier_np();
+
+    return 0;
+}
@@ -22,6 +22,7 @@
 
 #include <windows.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #include "pthread_impl.h"
 
@@ -43,15 +44,34 @@ int pthread_rwlock_init(pthread_rwlock_t *__lock,
         lock->state = UNINITIALIZED;
 
     rc = InterlockedCompareExchange(&lock->state, INITIALIZING, UNINITIALIZED);
-    if (rc == UNINITIALIZED) {
+    if (rc == UNINITIALIZED && attr && attr->shared == PTHREAD_PROCESS_SHARED) {
+        rc = slim_pthread_shared_rwlock_init(
+                (slim_pthread_shared_rwlock_t *)lock);
+        if (rc != 0) {
+            lock->state = UNINITIALIZED;
+            return (int)rc;
+        }
+
+        lock->sig = _PTHREAD_RWLOCK_INIT;
+        lock->state = INITIALIZED;
+    } else if (rc == UNINITIALIZED) {
+        lock->shared = PTHREAD_PROCESS_PRIVATE;
         lock->rwstate = TlsAlloc();
         if (lock->rwstate == TLS_OUT_OF_INDEXES) {
             lock->state = UNINITIALIZED;
             return EAGAIN;
         }
 
+        lock->stats = NULL;
+        if (slim_pthread_rwlock_stats_init(lock, attr) != 0) {
+            TlsFree(lock->rwstate);
+            lock->state = UNINITIALIZED;
+            return ENOMEM;
+        }
+
         lock->sig = _PTHREAD_RWLOCK_INIT;
         InitializeSRWLock(&lock->srwlock);
+        InitializeSRWLock(&lock->uplock);
         lock->state = INITIALIZED;
     } else {
         while (lock->state != INITIALIZED)
@@ -69,33 +89,134 @@ int pthread_rwlock_destroy(pthread_rwlock_t *__lock)
     if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT)
         return EINVAL;
 
+    // Process shared locks hold no resources between waits.
     rc = InterlockedCompareExchange(&lock->state, UNINITIALIZED, INITIALIZED);
-    if (rc == INITIALIZED)
+    if (rc == INITIALIZED && lock->shared != PTHREAD_PROCESS_SHARED) {
         TlsFree(lock->rwstate);
+        slim_pthread_rwlock_stats_destroy(lock);
+    }
 
     memset(lock, 0, sizeof(pthread_rwlock_t));
 
     return 0;
 }
 
-int pthread_rwlock_rdlock(pthread_rwlock_t *__lock)
+/*
+ * Every rwlock owns a TLS slot holding the modes this thread currently has
+ * the lock in, as a stack of RWSTATE_BITS wide entries with the most
+ * recent acquisition in the lowest bits.
+ */
+#define RWSTATE_NONE                    0x00
+#define RWSTATE_READ                    0x01
+#define RWSTATE_WRITE                   0x02
+#define RWSTATE_UPGRADABLE              0x03
+#define RWSTATE_MASK                    0x03
+#define RWSTATE_BITS                    2
+
+#define RWSTATE_TOP(s)                  ((s) & RWSTATE_MASK)
+#define RWSTATE_PUSH(s, m)              (((s) << RWSTATE_BITS) | (m))
+#define RWSTATE_POP(s)                  ((s) >> RWSTATE_BITS)
+#define RWSTATE_SET_TOP(s, m)           (((s) & ~(size_t)RWSTATE_MASK) | (m))
+#define RWSTATE_FULL(s) \
+    (((s) >> (sizeof(size_t) * 8 - RWSTATE_BITS)) != 0)
+
+static int rwlock_enter(slim_pthread_rwlock_t *lock, size_t *rwstate)
 {
-    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
-    size_t rwstate;
-
     if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT)
         return EINVAL;
 
     if (lock->state != INITIALIZED) {
-        int rc = pthread_rwlock_init(__lock, NULL);
+        int rc = pthread_rwlock_init((pthread_rwlock_t *)lock, NULL);
         if (rc != 0)
             return rc;
     }
 
-    rwstate = (size_t)TlsGetValue(lock->rwstate);
-    rwstate <<= 1;
-    AcquireSRWLockShared(&lock->srwlock);
-    TlsSetValue(lock->rwstate, (LPVOID)rwstate);
+    *rwstate = (size_t)TlsGetValue(lock->rwstate);
+    if (RWSTATE_FULL(*rwstate))
+        return EAGAIN;
+
+    return 0;
+}
+
+static int rwlock_held(slim_pthread_rwlock_t *lock, size_t *rwstate)
+{
+    if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT ||
+            lock->state != INITIALIZED)
+        return EINVAL;
+
+    *rwstate = (size_t)TlsGetValue(lock->rwstate);
+    if (RWSTATE_TOP(*rwstate) == RWSTATE_NONE)
+        return EPERM;
+
+    return 0;
+}
+
+// An upgrade waits for every other shared hold to go, including the
+// caller's own plain read holds below the upgradable one.
+static bool rwstate_read_below(size_t rwstate)
+{
+    for (rwstate = RWSTATE_POP(rwstate); rwstate;
+            rwstate = RWSTATE_POP(rwstate)) {
+        if (RWSTATE_TOP(rwstate) != RWSTATE_WRITE)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Process shared locks keep no per process state, so the TLS mode stack
+ * is not available for them; see pthread_shared.c.
+ */
+static bool rwlock_shared(slim_pthread_rwlock_t *lock)
+{
+    return lock && lock->sig == _PTHREAD_RWLOCK_INIT &&
+            lock->state == INITIALIZED &&
+            lock->shared == PTHREAD_PROCESS_SHARED;
+}
+
+/*
+ * With statistics enabled, acquisitions probe with a try first so that
+ * contention can be counted. Without them this is the plain acquire.
+ */
+static bool acquire_shared(SRWLOCK *srwlock, bool probe)
+{
+    if (probe && TryAcquireSRWLockShared(srwlock))
+        return false;
+
+    AcquireSRWLockShared(srwlock);
+    return probe;
+}
+
+static bool acquire_exclusive(SRWLOCK *srwlock, bool probe)
+{
+    if (probe && TryAcquireSRWLockExclusive(srwlock))
+        return false;
+
+    AcquireSRWLockExclusive(srwlock);
+    return probe;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *__lock)
+{
+    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
+    size_t rwstate;
+    bool contended;
+    int rc;
+
+    if (rwlock_shared(lock))
+        return slim_pthread_shared_rwlock_rdlock(
+                (slim_pthread_shared_rwlock_t *)lock, false);
+
+    rc = rwlock_enter(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    contended = acquire_shared(&lock->srwlock, lock->stats != NULL);
+    if (lock->stats)
+        slim_pthread_rwlock_stats_read(lock->stats, contended);
+
+    TlsSetValue(lock->rwstate, (LPVOID)RWSTATE_PUSH(rwstate, RWSTATE_READ));
 
     return 0;
 }
@@ -104,20 +225,55 @@ int pthread_rwlock_wrlock(pthread_rwlock_t *__lock)
 {
     slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
     size_t rwstate;
+    LONG64 start = 0;
+    bool contended;
+    int rc;
 
-    if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT)
-        return EINVAL;
+    if (rwlock_shared(lock))
+        return slim_pthread_shared_rwlock_wrlock(
+                (slim_pthread_shared_rwlock_t *)lock, false);
 
-    if (lock->state != INITIALIZED) {
-        int rc = pthread_rwlock_init(__lock, NULL);
-        if (rc != 0)
-            return rc;
-    }
+    rc = rwlock_enter(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    if (lock->stats)
+        start = slim_pthread_rwlock_stats_now();
+
+    // Writers queue on the upgrade lock first, so an upgradable reader
+    // never races a writer for the exclusive lock.
+    contended = acquire_exclusive(&lock->uplock, lock->stats != NULL);
+    contended |= acquire_exclusive(&lock->srwlock, lock->stats != NULL);
+    if (lock->stats)
+        slim_pthread_rwlock_stats_write(lock->stats, contended, start);
 
-    rwstate = (size_t)TlsGetValue(lock->rwstate);
-    rwstate = (rwstate << 1) | 0x01;
-    AcquireSRWLockExclusive(&lock->srwlock);
-    TlsSetValue(lock->rwstate, (LPVOID)rwstate);
+    TlsSetValue(lock->rwstate, (LPVOID)RWSTATE_PUSH(rwstate, RWSTATE_WRITE));
+
+    return 0;
+}
+
+int pthread_rwlock_uprdlock_np(pthread_rwlock_t *__lock)
+{
+    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
+    size_t rwstate;
+    bool contended;
+    int rc;
+
+    // Shared locks have no room for the upgrade lock.
+    if (rwlock_shared(lock))
+        return ENOTSUP;
+
+    rc = rwlock_enter(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    contended = acquire_exclusive(&lock->uplock, lock->stats != NULL);
+    contended |= acquire_shared(&lock->srwlock, lock->stats != NULL);
+    if (lock->stats)
+        slim_pthread_rwlock_stats_read(lock->stats, contended);
+
+    TlsSetValue(lock->rwstate,
+            (LPVOID)RWSTATE_PUSH(rwstate, RWSTATE_UPGRADABLE));
 
     return 0;
 }
@@ -126,70 +282,267 @@ int pthread_rwlock_tryrdlock(pthread_rwlock_t *__lock)
 {
     slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
     size_t rwstate;
-    BOOLEAN rc;
+    int rc;
 
-    if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT)
-        return EINVAL;
+    if (rwlock_shared(lock))
+        return slim_pthread_shared_rwlock_rdlock(
+                (slim_pthread_shared_rwlock_t *)lock, true);
 
-    if (lock->state != INITIALIZED) {
-        int rc = pthread_rwlock_init(__lock, NULL);
-        if (rc != 0)
-            return rc;
-    }
+    rc = rwlock_enter(lock, &rwstate);
+    if (rc != 0)
+        return rc;
 
-    rwstate = (size_t)TlsGetValue(lock->rwstate);
-    rwstate <<= 1;
-    rc = TryAcquireSRWLockShared(&lock->srwlock);
-    if (rc) {
-        TlsSetValue(lock->rwstate, (LPVOID)rwstate);
-        return 0;
-    } else
+    if (!TryAcquireSRWLockShared(&lock->srwlock)) {
+        if (lock->stats)
+            InterlockedIncrement64(
+                    (LONG64 *)&lock->stats->counters.rdlocks_contended);
         return EBUSY;
+    }
+
+    if (lock->stats)
+        slim_pthread_rwlock_stats_read(lock->stats, false);
+
+    TlsSetValue(lock->rwstate, (LPVOID)RWSTATE_PUSH(rwstate, RWSTATE_READ));
+    return 0;
 }
 
 int pthread_rwlock_trywrlock(pthread_rwlock_t *__lock)
 {
     slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
     size_t rwstate;
-    BOOLEAN rc;
+    int rc;
 
-    if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT)
-        return EINVAL;
+    if (rwlock_shared(lock))
+        return slim_pthread_shared_rwlock_wrlock(
+                (slim_pthread_shared_rwlock_t *)lock, true);
 
-    if (lock->state != INITIALIZED) {
-        int rc = pthread_rwlock_init(__lock, NULL);
-        if (rc != 0)
-            return rc;
+    rc = rwlock_enter(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    if (!TryAcquireSRWLockExclusive(&lock->uplock))
+        goto busy;
+
+    if (!TryAcquireSRWLockExclusive(&lock->srwlock)) {
+        ReleaseSRWLockExclusive(&lock->uplock);
+        goto busy;
+    }
+
+    if (lock->stats)
+        slim_pthread_rwlock_stats_write(lock->stats, false,
+                slim_pthread_rwlock_stats_now());
+
+    TlsSetValue(lock->rwstate, (LPVOID)RWSTATE_PUSH(rwstate, RWSTATE_WRITE));
+    return 0;
+
+busy:
+    if (lock->stats)
+        InterlockedIncrement64(
+                (LONG64 *)&lock->stats->counters.wrlocks_contended);
+    return EBUSY;
+}
+
+int pthread_rwlock_tryuprdlock_np(pthread_rwlock_t *__lock)
+{
+    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
+    size_t rwstate;
+    int rc;
+
+    // Shared locks have no room for the upgrade lock.
+    if (rwlock_shared(lock))
+        return ENOTSUP;
+
+    rc = rwlock_enter(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    if (!TryAcquireSRWLockExclusive(&lock->uplock))
+        goto busy;
+
+    if (!TryAcquireSRWLockShared(&lock->srwlock)) {
+        ReleaseSRWLockExclusive(&lock->uplock);
+        goto busy;
+    }
+
+    if (lock->stats)
+        slim_pthread_rwlock_stats_read(lock->stats, false);
+
+    TlsSetValue(lock->rwstate,
+            (LPVOID)RWSTATE_PUSH(rwstate, RWSTATE_UPGRADABLE));
+    return 0;
+
+busy:
+    if (lock->stats)
+        InterlockedIncrement64(
+                (LONG64 *)&lock->stats->counters.rdlocks_contended);
+    return EBUSY;
+}
+
+int pthread_rwlock_upgrade_np(pthread_rwlock_t *__lock)
+{
+    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
+    size_t rwstate;
+    LONG64 start = 0;
+    bool contended;
+    int rc;
+
+    // Shared locks have no room for the upgrade lock.
+    if (rwlock_shared(lock))
+        return ENOTSUP;
+
+    rc = rwlock_held(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    if (RWSTATE_TOP(rwstate) != RWSTATE_UPGRADABLE)
+        return EPERM;
+
+    if (rwstate_read_below(rwstate))
+        return EDEADLK;
+
+    if (lock->stats) {
+        slim_pthread_rwlock_stats_read_release(lock->stats);
+        start = slim_pthread_rwlock_stats_now();
+    }
+
+    // Holding the upgrade lock keeps every writer out, so only plain
+    // readers can run between dropping the shared lock and getting the
+    // exclusive one.
+    ReleaseSRWLockShared(&lock->srwlock);
+    contended = acquire_exclusive(&lock->srwlock, lock->stats != NULL);
+    if (lock->stats) {
+        InterlockedIncrement64((LONG64 *)&lock->stats->counters.upgrades);
+        slim_pthread_rwlock_stats_write(lock->stats, contended, start);
     }
 
-    rwstate = (size_t)TlsGetValue(lock->rwstate);
-    rwstate = (rwstate << 1) | 0x01;
-    rc = TryAcquireSRWLockExclusive(&lock->srwlock);
-    if (rc) {
-        TlsSetValue(lock->rwstate, (LPVOID)rwstate);
-        return 0;
-    } else
+    TlsSetValue(lock->rwstate,
+            (LPVOID)RWSTATE_SET_TOP(rwstate, RWSTATE_WRITE));
+
+    return 0;
+}
+
+int pthread_rwlock_tryupgrade_np(pthread_rwlock_t *__lock)
+{
+    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
+    size_t rwstate;
+    int rc;
+
+    // Shared locks have no room for the upgrade lock.
+    if (rwlock_shared(lock))
+        return ENOTSUP;
+
+    rc = rwlock_held(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    if (RWSTATE_TOP(rwstate) != RWSTATE_UPGRADABLE)
+        return EPERM;
+
+    if (rwstate_read_below(rwstate))
+        return EDEADLK;
+
+    ReleaseSRWLockShared(&lock->srwlock);
+    if (!TryAcquireSRWLockExclusive(&lock->srwlock)) {
+        AcquireSRWLockShared(&lock->srwlock);
+        if (lock->stats)
+            InterlockedIncrement64(
+                    (LONG64 *)&lock->stats->counters.wrlocks_contended);
         return EBUSY;
+    }
+
+    if (lock->stats) {
+        slim_pthread_rwlock_stats_read_release(lock->stats);
+        InterlockedIncrement64((LONG64 *)&lock->stats->counters.upgrades);
+        slim_pthread_rwlock_stats_write(lock->stats, false,
+                slim_pthread_rwlock_stats_now());
+    }
+
+    TlsSetValue(lock->rwstate,
+            (LPVOID)RWSTATE_SET_TOP(rwstate, RWSTATE_WRITE));
+    return 0;
 }
 
-int pthread_rwlock_unlock(pthread_rwlock_t *__lock)
+int pthread_rwlock_downgrade_np(pthread_rwlock_t *__lock)
 {
     slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
     size_t rwstate;
+    int rc;
 
-    if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT ||
-            lock->state != INITIALIZED)
-        return EINVAL;
+    if (rwlock_shared(lock))
+        return slim_pthread_shared_rwlock_downgrade(
+                (slim_pthread_shared_rwlock_t *)lock);
+
+    rc = rwlock_held(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    switch (RWSTATE_TOP(rwstate)) {
+    case RWSTATE_WRITE:
+        if (lock->stats)
+            slim_pthread_rwlock_stats_write_release(lock->stats);
 
-    rwstate = (size_t)TlsGetValue(lock->rwstate);
-    if (rwstate & 0x01)
+        // Same reasoning as upgrade: writers wait on the upgrade lock,
+        // which is only released once the shared lock is held.
         ReleaseSRWLockExclusive(&lock->srwlock);
-    else
+        AcquireSRWLockShared(&lock->srwlock);
+        ReleaseSRWLockExclusive(&lock->uplock);
+
+        if (lock->stats)
+            slim_pthread_rwlock_stats_read(lock->stats, false);
+        break;
+
+    case RWSTATE_UPGRADABLE:
+        ReleaseSRWLockExclusive(&lock->uplock);
+        break;
+
+    default:
+        return EPERM;
+    }
+
+    if (lock->stats)
+        InterlockedIncrement64((LONG64 *)&lock->stats->counters.downgrades);
+
+    TlsSetValue(lock->rwstate, (LPVOID)RWSTATE_SET_TOP(rwstate, RWSTATE_READ));
+    return 0;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *__lock)
+{
+    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
+    size_t rwstate;
+    int rc;
+
+    if (rwlock_shared(lock))
+        return slim_pthread_shared_rwlock_unlock(
+                (slim_pthread_shared_rwlock_t *)lock);
+
+    rc = rwlock_held(lock, &rwstate);
+    if (rc != 0)
+        return rc;
+
+    switch (RWSTATE_TOP(rwstate)) {
+    case RWSTATE_READ:
+        if (lock->stats)
+            slim_pthread_rwlock_stats_read_release(lock->stats);
         ReleaseSRWLockShared(&lock->srwlock);
+        break;
+
+    case RWSTATE_WRITE:
+        if (lock->stats)
+            slim_pthread_rwlock_stats_write_release(lock->stats);
+        ReleaseSRWLockExclusive(&lock->srwlock);
+        ReleaseSRWLockExclusive(&lock->uplock);
+        break;
 
-    rwstate >>= 1;
-    TlsSetValue(lock->rwstate, (LPVOID)rwstate);
+    case RWSTATE_UPGRADABLE:
+        if (lock->stats)
+            slim_pthread_rwlock_stats_read_release(lock->stats);
+        ReleaseSRWLockShared(&lock->srwlock);
+        ReleaseSRWLockExclusive(&lock->uplock);
+        break;
+    }
 
+    TlsSetValue(lock->rwstate, (LPVOID)RWSTATE_POP(rwstate));
     return 0;
 }
 
@@ -199,6 +552,7 @@ int pthread_rwlockattr_init(pthread_rwlockattr_t *__attr)
 
     attr->sig = _PTHREAD_RWLOCKATTR_INIT;
     attr->shared = PTHREAD_PROCESS_PRIVATE;
+    attr->stats = 0;
     return 0;
 }
 
@@ -235,3 +589,26 @@ int pthread_rwlockattr_setpshared(pthread_rwlockattr_t *__attr, int shared)
     attr->shared = shared;
     return 0;
 }
+
+int pthread_rwlockattr_getstats_np(const pthread_rwlockattr_t *__attr,
+        int *enable)
+{
+    slim_pthread_rwlockattr_t *attr = (slim_pthread_rwlockattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_RWLOCKATTR_INIT || !enable)
+        return EINVAL;
+
+    *enable = attr->stats;
+    return 0;
+}
+
+int pthread_rwlockattr_setstats_np(pthread_rwlockattr_t *__attr, int enable)
+{
+    slim_pthread_rwlockattr_t *attr = (slim_pthread_rwlockattr_t *)__attr;
+
+    if (!attr || attr->sig != _PTHREAD_RWLOCKATTR_INIT)
+        return EINVAL;
+
+    attr->stats = enable ? 1 : 0;
+    return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <windows.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "pthread_impl.h"
+
+/*
+ * Opt-in rwlock statistics. A lock gets a counter block when it is
+ * initialized with pthread_rwlockattr_setstats_np(attr, 1), or for every
+ * lock when the SLIM_PTHREAD_RWLOCK_STATS environment variable is set to a
+ * non zero value. Locks without one only pay a NULL check per operation.
+ */
+
+static INIT_ONCE stats_once = INIT_ONCE_STATIC_INIT;
+static bool stats_env = false;
+static LONG64 stats_frequency = 0;
+
+static slim_pthread_rwlock_stats_t registry = {
+    NULL, 0, 0, {0}, &registry, &registry};
+static SRWLOCK registry_lock = SRWLOCK_INIT;
+
+static
+BOOL CALLBACK stats_setup(PINIT_ONCE InitOnce, PVOID Parameter, PVOID *lpContext)
+{
+    LARGE_INTEGER frequency;
+    char value[16];
+    DWORD len;
+
+    len = GetEnvironmentVariableA("SLIM_PTHREAD_RWLOCK_STATS",
+            value, sizeof(value));
+    stats_env = len > 0 && len < sizeof(value) && strtol(value, NULL, 0) != 0;
+
+    QueryPerformanceFrequency(&frequency);
+    stats_frequency = frequency.QuadPart;
+    return TRUE;
+}
+
+static unsigned int stats_bucket(ULONG64 value)
+{
+    unsigned int bucket = 0;
+
+    while (value > 1 && bucket < PTHREAD_RWLOCK_STATS_BUCKETS_NP - 1) {
+        value >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static void stats_add(unsigned long long *histogram, ULONG64 value)
+{
+    InterlockedIncrement64((LONG64 *)&histogram[stats_bucket(value)]);
+}
+
+static ULONG64 stats_elapsed_ns(LONG64 start)
+{
+    LONG64 ticks = slim_pthread_rwlock_stats_now() - start;
+
+    if (ticks <= 0)
+        return 0;
+
+    return (ULONG64)(ticks / stats_frequency) * 1000000000ULL +
+            (ULONG64)(ticks % stats_frequency) * 1000000000ULL /
+            stats_frequency;
+}
+
+int slim_pthread_rwlock_stats_init(slim_pthread_rwlock_t *lock,
+        const slim_pthread_rwlockattr_t *attr)
+{
+    slim_pthread_rwlock_stats_t *stats;
+
+    InitOnceExecuteOnce(&stats_once, stats_setup, NULL, NULL);
+
+    if (!(attr && attr->stats) && !stats_env)
+        return 0;
+
+    stats = (slim_pthread_rwlock_stats_t *)calloc(1,
+            sizeof(slim_pthread_rwlock_stats_t));
+    if (!stats)
+        return ENOMEM;
+
+    stats->lock = (pthread_rwlock_t *)lock;
+
+    AcquireSRWLockExclusive(&registry_lock);
+    stats->prev = registry.prev;
+    stats->next = &registry;
+    registry.prev->next = stats;
+    registry.prev = stats;
+    ReleaseSRWLockExclusive(&registry_lock);
+
+    lock->stats = stats;
+    return 0;
+}
+
+void slim_pthread_rwlock_stats_destroy(slim_pthread_rwlock_t *lock)
+{
+    slim_pthread_rwlock_stats_t *stats = lock->stats;
+
+    if (!stats)
+        return;
+
+    AcquireSRWLockExclusive(&registry_lock);
+    stats->prev->next = stats->next;
+    stats->next->prev = stats->prev;
+    ReleaseSRWLockExclusive(&registry_lock);
+
+    lock->stats = NULL;
+    free(stats);
+}
+
+LONG64 slim_pthread_rwlock_stats_now(void)
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+void slim_pthread_rwlock_stats_read(slim_pthread_rwlock_stats_t *stats,
+        bool contended)
+{
+    long readers = InterlockedIncrement(&stats->readers);
+
+    InterlockedIncrement64((LONG64 *)&stats->counters.rdlocks);
+    if (contended)
+        InterlockedIncrement64((LONG64 *)&stats->counters.rdlocks_contended);
+
+    stats_add(stats->counters.readers, (ULONG64)readers);
+}
+
+void slim_pthread_rwlock_stats_read_release(slim_pthread_rwlock_stats_t *stats)
+{
+    InterlockedDecrement(&stats->readers);
+}
+
+void slim_pthread_rwlock_stats_write(slim_pthread_rwlock_stats_t *stats,
+        bool contended, LONG64 start)
+{
+    InterlockedIncrement64((LONG64 *)&stats->counters.wrlocks);
+    if (contended)
+        InterlockedIncrement64((LONG64 *)&stats->counters.wrlocks_contended);
+
+    stats_add(stats->counters.wrwait, stats_elapsed_ns(start));
+
+    // Only the writer touches wrstart until it releases the lock.
+    stats->wrstart = slim_pthread_rwlock_stats_now();
+}
+
+void slim_pthread_rwlock_stats_write_release(slim_pthread_rwlock_stats_t *stats)
+{
+    stats_add(stats->counters.wrhold, stats_elapsed_ns(stats->wrstart));
+}
+
+int pthread_rwlock_getstats_np(pthread_rwlock_t *__lock,
+        struct pthread_rwlock_stats_np *stats)
+{
+    slim_pthread_rwlock_t *lock = (slim_pthread_rwlock_t *)__lock;
+
+    if (!lock || lock->sig != _PTHREAD_RWLOCK_INIT || !stats)
+        return EINVAL;
+
+    if (lock->state != INITIALIZED ||
+            lock->shared == PTHREAD_PROCESS_SHARED || !lock->stats)
+        return ENOTSUP;
+
+    *stats = lock->stats->counters;
+    return 0;
+}
+
+int pthread_rwlock_enumstats_np(int (*callback)(pthread_rwlock_t *lock,
+        const struct pthread_rwlock_stats_np *stats, void *arg), void *arg)
+{
+    slim_pthread_rwlock_stats_t *current;
+    struct pthread_rwlock_stats_np snapshot;
+    int rc = 0;
+
+    if (!callback)
+        return EINVAL;
+
+    // Locks cannot be destroyed while the registry is held, so the
+    // callback must not destroy them either.
+    AcquireSRWLockShared(&registry_lock);
+    for (current = registry.next; current != &registry && rc == 0;
+            current = current->next) {
+        snapshot = current->counters;
+        rc = callback(current->lock, &snapshot, arg);
+    }
+    ReleaseSRWLockShared(&registry_lock);
+
+    return rc;
+}
+
+static void dump_histogram(FILE *stream, const char *name,
+        const unsigned long long *histogram)
+{
+    int i;
+
+    fprintf(stream, "  %s:", name);
+    for (i = 0; i < PTHREAD_RWLOCK_STATS_BUCKETS_NP; i++) {
+        if (histogram[i])
+            fprintf(stream, " [%llu]=%llu", 1ULL << i, histogram[i]);
+    }
+    fprintf(stream, "\n");
+}
+
+static int dump_lock(pthread_rwlock_t *lock,
+        const struct pthread_rwlock_stats_np *stats, void *arg)
+{
+    FILE *stream = (FILE *)arg;
+
+    fprintf(stream, "rwlock %p: rd %llu (contended %llu), "
+            "wr %llu (contended %llu), upgrades %llu, downgrades %llu\n",
+            (void *)lock, stats->rdlocks, stats->rdlocks_contended,
+            stats->wrlocks, stats->wrlocks_contended,
+            stats->upgrades, stats->downgrades);
+    dump_histogram(stream, "readers", stats->readers);
+    dump_histogram(stream, "wrwait ns", stats->wrwait);
+    dump_histogram(stream, "wrhold ns", stats->wrhold);
+    return 0;
+}
+
+int pthread_rwlock_dumpstats_np(FILE *stream)
+{
+    if (!stream)
+        return EINVAL;
+
+    pthread_rwlock_enumstats_np(dump_lock, (void *)stream);
+    fflush(stream);
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <windows.h>
+#include <errno.h>
+
+#include "pthread_impl.h"
+
+/*
+ * The sequence is odd while a writer is inside its critical section.
+ * Writers serialize on an SRW lock and bump the sequence with interlocked
+ * operations, which also order the protected stores against it. Readers
+ * are inline in pthread.h.
+ */
+
+int pthread_seqlock_init_np(pthread_seqlock_t *__lock)
+{
+    slim_pthread_seqlock_t *lock = (slim_pthread_seqlock_t *)__lock;
+
+    if (!lock)
+        return EINVAL;
+
+    lock->sig = _PTHREAD_SEQLOCK_INIT;
+    lock->seq = 0;
+    InitializeSRWLock(&lock->writelock);
+    return 0;
+}
+
+int pthread_seqlock_destroy_np(pthread_seqlock_t *__lock)
+{
+    slim_pthread_seqlock_t *lock = (slim_pthread_seqlock_t *)__lock;
+
+    if (!lock || lock->sig != _PTHREAD_SEQLOCK_INIT)
+        return EINVAL;
+
+    if (lock->seq & 1)
+        return EBUSY;
+
+    memset(lock, 0, sizeof(pthread_seqlock_t));
+    return 0;
+}
+
+int pthread_seqlock_write_lock_np(pthread_seqlock_t *__lock)
+{
+    slim_pthread_seqlock_t *lock = (slim_pthread_seqlock_t *)__lock;
+
+    if (!lock || lock->sig != _PTHREAD_SEQLOCK_INIT)
+        return EINVAL;
+
+    AcquireSRWLockExclusive(&lock->writelock);
+    InterlockedIncrement(&lock->seq);
+    return 0;
+}
+
+int pthread_seqlock_write_unlock_np(pthread_seqlock_t *__lock)
+{
+    slim_pthread_seqlock_t *lock = (slim_pthread_seqlock_t *)__lock;
+
+    if (!lock || lock->sig != _PTHREAD_SEQLOCK_INIT)
+        return EINVAL;
+
+    if (!(lock->seq & 1))
+        return EPERM;
+
+    InterlockedIncrement(&lock->seq);
+    ReleaseSRWLockExclusive(&lock->writelock);
+    return 0;
+}
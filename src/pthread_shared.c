@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <windows.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "pthread_impl.h"
+
+/*
+ * Process shared rwlocks and barriers keep all of their state in the
+ * mapped object and only go to the kernel to block. Each object names a
+ * pair of semaphores "Local\slim-pthread-<pid>-<serial>-<n>" after the
+ * process and serial that initialized it. Threads open the one they need
+ * around each wait or wake and close it again, so no process keeps
+ * handles, or the named objects, past its last use of an object.
+ */
+
+static volatile long serials = 0;
+
+/*
+ * Opens semaphore 'index' of an object, creating it if nobody holds it
+ * open. Threads that are going to block must open it before publishing
+ * themselves as waiters and keep it open until woken, so the semaphore and
+ * any count released to it live as long as somebody may consume it.
+ */
+static HANDLE shared_open(DWORD pid, DWORD serial, int index)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "Local\\slim-pthread-%lu-%lu-%d",
+            (unsigned long)pid, (unsigned long)serial, index);
+    return CreateSemaphoreA(NULL, 0, LONG_MAX, name);
+}
+
+// Releases count waiters blocked on semaphore 'index' of an object.
+static int shared_wake(DWORD pid, DWORD serial, int index, long count)
+{
+    HANDLE sem;
+
+    if (count <= 0)
+        return 0;
+
+    sem = shared_open(pid, serial, index);
+    if (!sem)
+        return EAGAIN;
+
+    ReleaseSemaphore(sem, count, NULL);
+    CloseHandle(sem);
+    return 0;
+}
+
+/*
+ * The shared rwlock packs its whole state in one word: the number of
+ * readers holding the lock, the number of readers waiting for a writer to
+ * leave, and the number of writers holding or waiting for the lock.
+ * Writers are preferred, readers arriving while any writer is present
+ * queue behind it and the releasing writer hands the lock to all of them
+ * at once. Readers and writers block on separate semaphores.
+ */
+#define SHARED_READERS_SHIFT            0
+#define SHARED_WAITERS_SHIFT            11
+#define SHARED_WRITERS_SHIFT            22
+#define SHARED_READERS_MAX              0x7FF
+#define SHARED_WRITERS_MAX              0x3FF
+
+#define SHARED_READER                   (1L << SHARED_READERS_SHIFT)
+#define SHARED_WAITER                   (1L << SHARED_WAITERS_SHIFT)
+#define SHARED_WRITER                   (1UL << SHARED_WRITERS_SHIFT)
+
+#define SHARED_READERS(s) \
+    (((unsigned long)(s) >> SHARED_READERS_SHIFT) & SHARED_READERS_MAX)
+#define SHARED_WAITERS(s) \
+    (((unsigned long)(s) >> SHARED_WAITERS_SHIFT) & SHARED_READERS_MAX)
+#define SHARED_WRITERS(s) \
+    (((unsigned long)(s) >> SHARED_WRITERS_SHIFT) & SHARED_WRITERS_MAX)
+
+#define SHARED_RWLOCK_READ              0
+#define SHARED_RWLOCK_WRITE             1
+
+int slim_pthread_shared_rwlock_init(slim_pthread_shared_rwlock_t *lock)
+{
+    lock->status = 0;
+    lock->pid = GetCurrentProcessId();
+    lock->serial = (DWORD)InterlockedIncrement(&serials);
+    lock->shared = PTHREAD_PROCESS_SHARED;
+    return 0;
+}
+
+int slim_pthread_shared_rwlock_rdlock(slim_pthread_shared_rwlock_t *lock,
+        bool trylock)
+{
+    HANDLE sem = NULL;
+    long status, next, prev;
+    int rc = 0;
+
+    status = lock->status;
+    for (;;) {
+        // Keeping readers plus waiters under the limit means a writer
+        // can always hand the lock to every waiter without overflow.
+        if (SHARED_READERS(status) + SHARED_WAITERS(status) >=
+                SHARED_READERS_MAX) {
+            rc = EAGAIN;
+            break;
+        }
+
+        if (SHARED_WRITERS(status) == 0) {
+            next = status + SHARED_READER;
+        } else {
+            if (trylock) {
+                rc = EBUSY;
+                break;
+            }
+
+            if (!sem) {
+                sem = shared_open(lock->pid, lock->serial,
+                        SHARED_RWLOCK_READ);
+                if (!sem)
+                    return EAGAIN;
+            }
+            next = status + SHARED_WAITER;
+        }
+
+        prev = InterlockedCompareExchange(&lock->status, next, status);
+        if (prev == status)
+            break;
+        status = prev;
+    }
+
+    // The writer that wakes us has already counted us as a reader.
+    if (rc == 0 && SHARED_WRITERS(status) != 0)
+        WaitForSingleObject(sem, INFINITE);
+
+    if (sem)
+        CloseHandle(sem);
+
+    return rc;
+}
+
+int slim_pthread_shared_rwlock_wrlock(slim_pthread_shared_rwlock_t *lock,
+        bool trylock)
+{
+    HANDLE sem = NULL;
+    long status, prev;
+    int rc = 0;
+
+    status = lock->status;
+    for (;;) {
+        if (status == 0) {
+            prev = InterlockedCompareExchange(&lock->status,
+                    (long)SHARED_WRITER, 0);
+            if (prev == 0)
+                break;
+
+            status = prev;
+            continue;
+        }
+
+        if (trylock) {
+            rc = EBUSY;
+            break;
+        }
+
+        if (SHARED_WRITERS(status) == SHARED_WRITERS_MAX) {
+            rc = EAGAIN;
+            break;
+        }
+
+        if (!sem) {
+            sem = shared_open(lock->pid, lock->serial, SHARED_RWLOCK_WRITE);
+            if (!sem)
+                return EAGAIN;
+        }
+
+        prev = InterlockedCompareExchange(&lock->status,
+                (long)(status + SHARED_WRITER), status);
+        if (prev == status) {
+            // Whoever leaves the lock free with us still counted wakes us.
+            WaitForSingleObject(sem, INFINITE);
+            break;
+        }
+        status = prev;
+    }
+
+    if (sem)
+        CloseHandle(sem);
+
+    return rc;
+}
+
+int slim_pthread_shared_rwlock_unlock(slim_pthread_shared_rwlock_t *lock)
+{
+    long status, next, prev, waiters = 0;
+
+    // A writer holding the lock implies no readers, so the reader count
+    // tells which mode the caller holds it in.
+    status = lock->status;
+    for (;;) {
+        if (SHARED_READERS(status) != 0) {
+            next = status - SHARED_READER;
+        } else if (SHARED_WRITERS(status) != 0) {
+            waiters = SHARED_WAITERS(status);
+            next = (long)(status - SHARED_WRITER) -
+                    waiters * SHARED_WAITER + waiters * SHARED_READER;
+        } else {
+            return EPERM;
+        }
+
+        prev = InterlockedCompareExchange(&lock->status, next, status);
+        if (prev == status)
+            break;
+        status = prev;
+    }
+
+    if (SHARED_READERS(status) != 0) {
+        if (SHARED_READERS(status) != 1 || SHARED_WRITERS(status) == 0)
+            return 0;
+    } else if (waiters == 0 && SHARED_WRITERS(status) == 1) {
+        return 0;
+    }
+
+    if (SHARED_READERS(status) != 0 || waiters == 0)
+        return shared_wake(lock->pid, lock->serial, SHARED_RWLOCK_WRITE, 1);
+
+    return shared_wake(lock->pid, lock->serial, SHARED_RWLOCK_READ, waiters);
+}
+
+int slim_pthread_shared_rwlock_downgrade(slim_pthread_shared_rwlock_t *lock)
+{
+    long status, next, prev, waiters;
+
+    status = lock->status;
+    for (;;) {
+        if (SHARED_READERS(status) != 0 || SHARED_WRITERS(status) == 0)
+            return EPERM;
+
+        // Queued readers are let in along with us. Writers still waiting
+        // are woken by the last reader to leave.
+        waiters = SHARED_WAITERS(status);
+        next = (long)(status - SHARED_WRITER) -
+                waiters * SHARED_WAITER + (waiters + 1) * SHARED_READER;
+
+        prev = InterlockedCompareExchange(&lock->status, next, status);
+        if (prev == status)
+            break;
+        status = prev;
+    }
+
+    return shared_wake(lock->pid, lock->serial, SHARED_RWLOCK_READ, waiters);
+}
+
+/*
+ * The shared barrier counts arrivals down and the last one in resets the
+ * count, advances the generation and releases everybody else. Waiters of
+ * consecutive generations block on different semaphores: a thread can
+ * only get two generations ahead once every waiter of the current one has
+ * been woken, so a fast thread never steals a wakeup meant for a slow one.
+ */
+int slim_pthread_shared_barrier_init(slim_pthread_shared_barrier_t *barrier,
+        unsigned int count)
+{
+    barrier->count = count;
+    barrier->remaining = (long)count;
+    barrier->generation = 0;
+    barrier->pid = GetCurrentProcessId();
+    barrier->serial = (DWORD)InterlockedIncrement(&serials);
+    barrier->shared = PTHREAD_PROCESS_SHARED;
+    return 0;
+}
+
+int slim_pthread_shared_barrier_wait(slim_pthread_shared_barrier_t *barrier)
+{
+    HANDLE sem;
+    long generation;
+
+    // The generation cannot move before this thread has arrived.
+    generation = barrier->generation;
+    sem = shared_open(barrier->pid, barrier->serial, (int)(generation & 1));
+    if (!sem)
+        return EAGAIN;
+
+    if (InterlockedDecrement(&barrier->remaining) == 0) {
+        InterlockedExchange(&barrier->remaining, (long)barrier->count);
+        InterlockedIncrement(&barrier->generation);
+        if (barrier->count > 1)
+            ReleaseSemaphore(sem, (long)barrier->count - 1, NULL);
+        CloseHandle(sem);
+        return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+
+    WaitForSingleObject(sem, INFINITE);
+    CloseHandle(sem);
+    return 0;
+}
@@ -71,18 +71,18 @@ int main()
 	}
 
   	rc = pthread_attr_setschedpolicy(&attr, FIFOPOLICY);
-	if( rc != ENOTSUP) {
+	if( rc != 0) {
 		printf(ERROR_PREFIX "pthread_attr_setschedpolicy\n");
 		exit(PTS_UNRESOLVED);
 	}
-  	verify_policy(&attr, OTHERPOLICY);
+  	verify_policy(&attr, FIFOPOLICY);
 
   	rc = pthread_attr_setschedpolicy(&attr, RRPOLICY);
-	if( rc != ENOTSUP) {
+	if( rc != 0) {
 		printf(ERROR_PREFIX "pthread_attr_setschedpolicy\n");
 		exit(PTS_UNRESOLVED);
 	}
-  	verify_policy(&attr, OTHERPOLICY);
+  	verify_policy(&attr, RRPOLICY);
 
   	rc = pthread_attr_setschedpolicy(&attr, OTHERPOLICY);
 	if( rc != 0) {
@@ -66,7 +66,7 @@ int main()
 	}
 
 	rc = pthread_attr_setschedpolicy(&attr, policy); 	
-	if (rc != ENOTSUP ) {
+	if (rc != 0 ) {
 		perror(ERROR_PREFIX "pthread_attr_setschedpolicy");
 		exit(PTS_UNRESOLVED);
         } 
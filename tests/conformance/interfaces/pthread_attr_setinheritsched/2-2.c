@@ -50,7 +50,7 @@ void *thread_func(void* arg)
                 perror(ERROR_PREFIX "pthread_getschedparam");
                 exit(PTS_UNRESOLVED);
         }
-	if (new_policy != old_policy) {
+	if (new_policy == old_policy) {
 		fprintf(stderr, ERROR_PREFIX "The scheduling attribute should "
                         "not be inherited from creating thread \n");
 		exit(PTS_FAIL);
@@ -73,14 +73,14 @@ int main()
 	}
 
 	rc = pthread_attr_setschedpolicy(&attr, policy); 	
-	if (rc != ENOTSUP ) {
+	if (rc != 0 ) {
 		printf(ERROR_PREFIX "pthread_attr_setschedpolicy");
 		exit(PTS_UNRESOLVED);
         } 
 	
 	sp.sched_priority = 1;
 	rc = pthread_attr_setschedparam(&attr, &sp); 	
-	if (rc != EINVAL ) {
+	if (rc != 0 ) {
 		printf(ERROR_PREFIX "pthread_attr_setschedparam");
 		exit(PTS_UNRESOLVED);
         } 
@@ -43,10 +43,10 @@ void *thread(void *tmp)
 		printf(ERROR_PREFIX "pthread_getschedparam\n");
 		exit(PTS_UNRESOLVED);
 	}
-	if(policy == SCHED_OTHER) {
+	if(policy == POLICY) {
 		policy_correct = 1;
 	}
-	if(param.sched_priority == 0) {
+	if(param.sched_priority == PRIORITY) {
 		priority_correct = 1;
 	}
 
@@ -63,7 +63,7 @@ int main()
 	param.sched_priority = PRIORITY;
 
 	rc = pthread_setschedparam(pthread_self(), POLICY, &param);
-	if(rc != ENOTSUP) {
+	if(rc != 0) {
 		printf(ERROR_PREFIX "pthread_setschedparam\n");
 		exit(PTS_UNRESOLVED);
 	}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_attr_setnumanode_np(pthread_attr_t *attr, int node)
+ *
+ *	keeps threads created with the attr on the processors of 'node',
+ *	as reported by pthread_getnumanode_np().
+ *
+ * Steps:
+ * 1.  A new attr should report PTHREAD_NUMA_NODE_ANY_NP, a negative node
+ *     should get EINVAL.
+ * 2.  Set node 0, which exists on every machine.
+ * 3.  Create a thread with the attr, it should only ever find itself on
+ *     node 0.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+static void* fn_chld(void *arg)
+{
+	int i, node;
+
+	for (i = 0; i < 100; i++) {
+		if (pthread_getnumanode_np(&node) != 0 || node != 0)
+			return (void *)PTS_FAIL;
+		Sleep(0);
+	}
+
+	return (void *)PTS_PASS;
+}
+
+int main()
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	void *thread_rc;
+	int node;
+
+	if (pthread_attr_init(&attr) != 0) {
+		printf("Error at pthread_attr_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_attr_getnumanode_np(&attr, &node) != 0 ||
+			node != PTHREAD_NUMA_NODE_ANY_NP) {
+		printf("Test FAILED: default node is not PTHREAD_NUMA_NODE_ANY_NP\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_attr_setnumanode_np(&attr, -2) != EINVAL) {
+		printf("Test FAILED: negative node did not get EINVAL\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_attr_setnumanode_np(&attr, 0) != 0) {
+		printf("Test FAILED: pthread_attr_setnumanode_np() failed for node 0\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_create(&thread, &attr, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_join(thread, &thread_rc) != 0) {
+		printf("Error at pthread_join()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if ((long)thread_rc != PTS_PASS) {
+		printf("Test FAILED: thread ran outside node 0\n");
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_attr_setscope(pthread_attr_t *attr, int scope)
+ *
+ *	with PTHREAD_SCOPE_PROCESS creates threads that block in mutexes,
+ *	conds and joins without blocking the carriers they run on.
+ *
+ * Steps:
+ * 1.  Use two carriers with pthread_setconcurrency().
+ * 2.  Create NUM_OF_THREADS process scope threads. Each one locks a
+ *     mutex, counts itself and waits on a cond until main broadcasts.
+ * 3.  Once all threads are waiting, broadcast. Every thread should be
+ *     able to wait at the same time, which two blocked carriers could not.
+ * 4.  A last process scope thread joins another one, main joins all of
+ *     them and checks their return values.
+ * 5.  Repeat step 2 and 3 with system scope threads. For both scopes,
+ *     print the time and the private commit per thread taken to get all
+ *     of them waiting.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <psapi.h>
+#include "posixtest.h"
+
+#define NUM_OF_THREADS 1000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t waiting = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t go = PTHREAD_COND_INITIALIZER;
+static int count = 0;
+static int started = 0;
+
+static void* fn_chld(void *arg)
+{
+	pthread_mutex_lock(&mutex);
+	count++;
+	pthread_cond_signal(&waiting);
+	while (!started)
+		pthread_cond_wait(&go, &mutex);
+	pthread_mutex_unlock(&mutex);
+
+	return arg;
+}
+
+static void* fn_join(void *arg)
+{
+	void *value;
+
+	if (pthread_join(*(pthread_t *)arg, &value) != 0)
+		return NULL;
+
+	return value;
+}
+
+static SIZE_T private_usage(void)
+{
+	PROCESS_MEMORY_COUNTERS_EX pmc;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(),
+			(PROCESS_MEMORY_COUNTERS *)&pmc, sizeof(pmc))) {
+		printf("Error at GetProcessMemoryInfo()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	return pmc.PrivateUsage;
+}
+
+/* Creates NUM_OF_THREADS threads and returns once all of them wait */
+static void spawn(pthread_attr_t *attr, pthread_t *threads,
+		const char *label)
+{
+	LARGE_INTEGER freq, before, after;
+	SIZE_T memory, grown;
+	int i;
+
+	pthread_mutex_lock(&mutex);
+	count = 0;
+	started = 0;
+	pthread_mutex_unlock(&mutex);
+
+	QueryPerformanceFrequency(&freq);
+	memory = private_usage();
+	QueryPerformanceCounter(&before);
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		if (pthread_create(&threads[i], attr, fn_chld,
+				(void *)(long)(i + 1)) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	pthread_mutex_lock(&mutex);
+	while (count < NUM_OF_THREADS)
+		pthread_cond_wait(&waiting, &mutex);
+	pthread_mutex_unlock(&mutex);
+
+	QueryPerformanceCounter(&after);
+	grown = private_usage();
+	memory = grown > memory ? grown - memory : 0;
+
+	printf("%s scope: %.1f us and %lu bytes per thread\n", label,
+			(after.QuadPart - before.QuadPart) * 1e6 / freq.QuadPart /
+			NUM_OF_THREADS, (unsigned long)(memory / NUM_OF_THREADS));
+}
+
+static void release(void)
+{
+	pthread_mutex_lock(&mutex);
+	started = 1;
+	pthread_cond_broadcast(&go);
+	pthread_mutex_unlock(&mutex);
+}
+
+int main()
+{
+	pthread_attr_t attr;
+	pthread_t threads[NUM_OF_THREADS], joiner;
+	void *value;
+	int i, scope;
+
+	if (pthread_setconcurrency(2) != 0 || pthread_getconcurrency() != 2) {
+		printf("Test FAILED: pthread_setconcurrency() failed\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_attr_init(&attr) != 0) {
+		printf("Error at pthread_attr_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_attr_setscope(&attr, PTHREAD_SCOPE_PROCESS) != 0 ||
+			pthread_attr_getscope(&attr, &scope) != 0 ||
+			scope != PTHREAD_SCOPE_PROCESS) {
+		printf("Test FAILED: PTHREAD_SCOPE_PROCESS was not accepted\n");
+		return PTS_FAIL;
+	}
+
+	spawn(&attr, threads, "process");
+	release();
+
+	if (pthread_create(&joiner, &attr, fn_join, &threads[0]) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_join(joiner, &value) != 0 || (long)value != 1) {
+		printf("Test FAILED: process scope join returned %p\n", value);
+		return PTS_FAIL;
+	}
+
+	for (i = 1; i < NUM_OF_THREADS; i++) {
+		if (pthread_join(threads[i], &value) != 0) {
+			printf("Error at pthread_join()\n");
+			return PTS_UNRESOLVED;
+		}
+
+		if ((long)value != i + 1) {
+			printf("Test FAILED: thread %d returned %p\n", i, value);
+			return PTS_FAIL;
+		}
+	}
+
+	if (pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM) != 0) {
+		printf("Test FAILED: PTHREAD_SCOPE_SYSTEM was not accepted\n");
+		return PTS_FAIL;
+	}
+
+	spawn(&attr, threads, "system");
+	release();
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		if (pthread_join(threads[i], &value) != 0 ||
+				(long)value != i + 1) {
+			printf("Test FAILED: system scope thread %d returned %p\n",
+					i, value);
+			return PTS_FAIL;
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_attr_setstackpolicy_np(pthread_attr_t *attr, int policy)
+ *
+ *	selects whether the requested stack size is only reserved
+ *	(PTHREAD_STACK_RESERVE_NP, the default) or committed up front
+ *	(PTHREAD_STACK_COMMIT_NP).
+ *
+ * Steps:
+ * 1.  A new attr should report PTHREAD_STACK_RESERVE_NP, an unknown
+ *     policy should get EINVAL.
+ * 2.  Create a thread with an 8 MB stack for each policy. The thread
+ *     walks its stack allocation with VirtualQuery() and sums the
+ *     committed pages.
+ * 3.  The reserved stack should have committed far less than 8 MB, the
+ *     committed one at least 8 MB.
+ * 4.  Create a thread with a GUARD_SIZE guardsize. The lowest GUARD_SIZE
+ *     bytes of its stack allocation should be committed and
+ *     PAGE_NOACCESS.
+ * 5.  A guardsize larger than the stack should make pthread_create() fail
+ *     with EINVAL.
+ * 6.  For each policy, park NUM_OF_PARKED threads with PARKED_STACK stacks
+ *     on a barrier and print how much the private commit of the process
+ *     grew. The reserved policy should have grown it less.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <psapi.h>
+#include "posixtest.h"
+
+#define STACK_SIZE (8 * 1024 * 1024)
+#define GUARD_SIZE (64 * 1024)
+
+#define NUM_OF_PARKED 2000
+#define PARKED_STACK  (256 * 1024)
+
+static pthread_t parked_threads[NUM_OF_PARKED];
+static pthread_barrier_t parked;
+
+static void* fn_chld(void *arg)
+{
+	MEMORY_BASIC_INFORMATION mbi;
+	char *base, *address;
+	size_t committed = 0;
+
+	if (!VirtualQuery(&mbi, &mbi, sizeof(mbi)))
+		return NULL;
+
+	base = (char *)mbi.AllocationBase;
+	for (address = base; VirtualQuery(address, &mbi, sizeof(mbi)) &&
+			mbi.AllocationBase == base;
+			address += mbi.RegionSize) {
+		if (mbi.State == MEM_COMMIT)
+			committed += mbi.RegionSize;
+	}
+
+	return (void *)committed;
+}
+
+static void* fn_guard(void *arg)
+{
+	MEMORY_BASIC_INFORMATION mbi;
+
+	if (!VirtualQuery(&mbi, &mbi, sizeof(mbi)) ||
+			!VirtualQuery(mbi.AllocationBase, &mbi, sizeof(mbi)))
+		return (void *)PTS_UNRESOLVED;
+
+	if (mbi.State != MEM_COMMIT || mbi.Protect != PAGE_NOACCESS ||
+			mbi.RegionSize < GUARD_SIZE)
+		return (void *)PTS_FAIL;
+
+	return (void *)PTS_PASS;
+}
+
+static void* fn_parked(void *arg)
+{
+	/* Once when everybody is up, once more when main has measured */
+	pthread_barrier_wait(&parked);
+	pthread_barrier_wait(&parked);
+	return NULL;
+}
+
+static SIZE_T private_usage(void)
+{
+	PROCESS_MEMORY_COUNTERS_EX pmc;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(),
+			(PROCESS_MEMORY_COUNTERS *)&pmc, sizeof(pmc))) {
+		printf("Error at GetProcessMemoryInfo()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	return pmc.PrivateUsage;
+}
+
+static SIZE_T committed_parked(int policy)
+{
+	pthread_attr_t attr;
+	SIZE_T before, after;
+	int i;
+
+	if (pthread_attr_init(&attr) != 0 ||
+			pthread_attr_setstacksize(&attr, PARKED_STACK) != 0 ||
+			pthread_attr_setstackpolicy_np(&attr, policy) != 0 ||
+			pthread_barrier_init(&parked, NULL, NUM_OF_PARKED + 1) != 0) {
+		printf("Error setting up the parked threads\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	before = private_usage();
+	for (i = 0; i < NUM_OF_PARKED; i++) {
+		if (pthread_create(&parked_threads[i], &attr, fn_parked,
+				NULL) != 0) {
+			printf("Error at pthread_create() for thread %d\n", i);
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	pthread_barrier_wait(&parked);
+	after = private_usage();
+	pthread_barrier_wait(&parked);
+
+	for (i = 0; i < NUM_OF_PARKED; i++)
+		pthread_join(parked_threads[i], NULL);
+
+	pthread_barrier_destroy(&parked);
+	pthread_attr_destroy(&attr);
+	return after > before ? after - before : 0;
+}
+
+static int create_guarded(size_t guardsize, void **thread_rc)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int rc;
+
+	if (pthread_attr_init(&attr) != 0 ||
+			pthread_attr_setstacksize(&attr, 1024 * 1024) != 0 ||
+			pthread_attr_setguardsize(&attr, guardsize) != 0) {
+		printf("Error setting up the thread attributes\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	rc = pthread_create(&thread, &attr, fn_guard, NULL);
+	pthread_attr_destroy(&attr);
+	if (rc != 0)
+		return rc;
+
+	if (pthread_join(thread, thread_rc) != 0) {
+		printf("Error at pthread_join()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	return 0;
+}
+
+static size_t committed_stack(int policy)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	void *committed;
+
+	if (pthread_attr_init(&attr) != 0 ||
+			pthread_attr_setstacksize(&attr, STACK_SIZE) != 0 ||
+			pthread_attr_setstackpolicy_np(&attr, policy) != 0) {
+		printf("Error setting up the thread attributes\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	if (pthread_create(&thread, &attr, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	if (pthread_join(thread, &committed) != 0) {
+		printf("Error at pthread_join()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	pthread_attr_destroy(&attr);
+	return (size_t)committed;
+}
+
+int main()
+{
+	pthread_attr_t attr;
+	size_t reserved, committed;
+	SIZE_T reserved_total, committed_total;
+	void *thread_rc;
+	int policy;
+
+	if (pthread_attr_init(&attr) != 0) {
+		printf("Error at pthread_attr_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_attr_getstackpolicy_np(&attr, &policy) != 0 ||
+			policy != PTHREAD_STACK_RESERVE_NP) {
+		printf("Test FAILED: default policy is not PTHREAD_STACK_RESERVE_NP\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_attr_setstackpolicy_np(&attr, -1) != EINVAL) {
+		printf("Test FAILED: unknown policy did not get EINVAL\n");
+		return PTS_FAIL;
+	}
+
+	reserved = committed_stack(PTHREAD_STACK_RESERVE_NP);
+	committed = committed_stack(PTHREAD_STACK_COMMIT_NP);
+
+	if (reserved == 0 || reserved >= STACK_SIZE / 4) {
+		printf("Test FAILED: reserved stack committed %lu bytes\n",
+				(unsigned long)reserved);
+		return PTS_FAIL;
+	}
+
+	if (committed < STACK_SIZE) {
+		printf("Test FAILED: committed stack committed only %lu bytes\n",
+				(unsigned long)committed);
+		return PTS_FAIL;
+	}
+
+	if (create_guarded(GUARD_SIZE, &thread_rc) != 0) {
+		printf("Test FAILED: pthread_create() failed with a guardsize\n");
+		return PTS_FAIL;
+	}
+
+	if ((long)thread_rc != PTS_PASS) {
+		printf("Test FAILED: no guard region at the end of the stack\n");
+		return PTS_FAIL;
+	}
+
+	if (create_guarded(16 * 1024 * 1024, &thread_rc) != EINVAL) {
+		printf("Test FAILED: oversized guardsize did not get EINVAL\n");
+		return PTS_FAIL;
+	}
+
+	reserved_total = committed_parked(PTHREAD_STACK_RESERVE_NP);
+	committed_total = committed_parked(PTHREAD_STACK_COMMIT_NP);
+
+	printf("%d threads with %d KB stacks: %lu KB committed reserved, "
+			"%lu KB committed up front\n", NUM_OF_PARKED, PARKED_STACK / 1024,
+			(unsigned long)(reserved_total / 1024),
+			(unsigned long)(committed_total / 1024));
+
+	if (reserved_total >= committed_total) {
+		printf("Test FAILED: reserved stacks committed as much as "
+				"committed ones\n");
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_barrier_arrive_np(pthread_barrier_t *barrier,
+ *	pthread_barrier_token_np *token)
+ *
+ *	returns without waiting for the other threads, and that
+ *	pthread_barrier_wait_np() on its token returns once the phase is
+ *	complete.
+ *
+ * Steps:
+ * 1.  THREADS threads loop over ROUNDS rounds; in each round a thread
+ *     publishes its round number in one of two buffers, arrives, does some
+ *     independent work, then waits on its token and checks that every
+ *     thread published the round.
+ * 2.  Exactly one thread per round should get
+ *     PTHREAD_BARRIER_SERIAL_THREAD from the arrive.
+ * 3.  A single thread barrier should complete the phase on arrival, and
+ *     waiting on its token should not block.
+ * 4.  Split phase operations on a tree barrier should get ENOTSUP.
+ * 5.  THREADS threads with uneven work per round run IDLE_ROUNDS rounds,
+ *     once doing their independent work after pthread_barrier_wait() and
+ *     once between arrive and wait. Print the time threads spent blocked
+ *     and the total time for both.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define THREADS		8
+#define ROUNDS		2000
+#define IDLE_ROUNDS	500
+#define WORK		20000
+
+static pthread_barrier_t barrier;
+static volatile long published[2][THREADS];
+static volatile long serials;
+static volatile long missing;
+static volatile long failures;
+static LONGLONG idle[THREADS];
+static int split;
+
+static void* fn(void *arg)
+{
+	int index = (int)(size_t)arg;
+	pthread_barrier_token_np token;
+	volatile unsigned int work = 0;
+	int i, j, rc;
+
+	for (i = 1; i <= ROUNDS; i++) {
+		published[i % 2][index] = i;
+
+		rc = pthread_barrier_arrive_np(&barrier, &token);
+		if (rc == PTHREAD_BARRIER_SERIAL_THREAD)
+			InterlockedIncrement(&serials);
+		else if (rc != 0)
+			InterlockedIncrement(&failures);
+
+		for (j = 0; j < 1000; j++)
+			work += j;
+
+		if (pthread_barrier_wait_np(&barrier, token) != 0)
+			InterlockedIncrement(&failures);
+
+		for (j = 0; j < THREADS; j++) {
+			if (published[i % 2][j] != i)
+				InterlockedIncrement(&missing);
+		}
+	}
+
+	return NULL;
+}
+
+static void work(unsigned int amount)
+{
+	volatile unsigned int sum = 0;
+	unsigned int j;
+
+	for (j = 0; j < amount; j++)
+		sum += j;
+}
+
+static void* fn_idle(void *arg)
+{
+	int index = (int)(size_t)arg;
+	pthread_barrier_token_np token;
+	LARGE_INTEGER before, after;
+	int i;
+
+	idle[index] = 0;
+	for (i = 0; i < IDLE_ROUNDS; i++) {
+		/* Thread i has i + 1 units of work before the barrier */
+		work(WORK * (index + 1));
+
+		if (split) {
+			pthread_barrier_arrive_np(&barrier, &token);
+			work(WORK * THREADS / 2);
+			QueryPerformanceCounter(&before);
+			pthread_barrier_wait_np(&barrier, token);
+			QueryPerformanceCounter(&after);
+		} else {
+			QueryPerformanceCounter(&before);
+			pthread_barrier_wait(&barrier);
+			QueryPerformanceCounter(&after);
+			work(WORK * THREADS / 2);
+		}
+
+		idle[index] += after.QuadPart - before.QuadPart;
+	}
+
+	return NULL;
+}
+
+/* Returns the total run time in ms and the blocked time in *blocked_ms */
+static double run_idle(int split_phase, double *blocked_ms)
+{
+	pthread_t threads[THREADS];
+	LARGE_INTEGER freq, before, after;
+	LONGLONG blocked = 0;
+	int i;
+
+	split = split_phase;
+	if (pthread_barrier_init(&barrier, NULL, THREADS) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&before);
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn_idle,
+		    (void *)(size_t)i) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	QueryPerformanceCounter(&after);
+	pthread_barrier_destroy(&barrier);
+
+	for (i = 0; i < THREADS; i++)
+		blocked += idle[i];
+
+	*blocked_ms = blocked * 1e3 / freq.QuadPart;
+	return (after.QuadPart - before.QuadPart) * 1e3 / freq.QuadPart;
+}
+
+int main()
+{
+	pthread_barrierattr_t attr;
+	pthread_barrier_token_np token;
+	pthread_t threads[THREADS];
+	double wait_total, wait_blocked, split_total, split_blocked;
+	int i, rc;
+
+	if (pthread_barrier_init(&barrier, NULL, 1) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_barrier_arrive_np(&barrier, &token);
+	if (rc != PTHREAD_BARRIER_SERIAL_THREAD) {
+		printf("Test FAILED: single thread arrive returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	if (pthread_barrier_wait_np(&barrier, token) != 0) {
+		printf("Test FAILED: waiting on a completed phase failed\n");
+		return PTS_FAIL;
+	}
+
+	pthread_barrier_destroy(&barrier);
+
+	if (pthread_barrier_init(&barrier, NULL, THREADS) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn, (void *)(size_t)i) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&barrier);
+
+	if (failures != 0 || missing != 0 || serials != ROUNDS) {
+		printf("Test FAILED: %ld failures, %ld missing values, "
+		       "%ld serial threads for %d rounds\n",
+		       failures, missing, serials, ROUNDS);
+		return PTS_FAIL;
+	}
+
+	if (pthread_barrierattr_init(&attr) != 0 ||
+	    pthread_barrierattr_settype_np(&attr, PTHREAD_BARRIER_TREE_NP) != 0 ||
+	    pthread_barrier_init(&barrier, &attr, 2) != 0) {
+		printf("Error initializing a tree barrier\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_barrier_arrive_np(&barrier, &token);
+	if (rc != ENOTSUP) {
+		printf("Test FAILED: expected ENOTSUP on a tree barrier, got %d\n",
+		       rc);
+		return PTS_FAIL;
+	}
+
+	pthread_barrier_destroy(&barrier);
+	pthread_barrierattr_destroy(&attr);
+
+	wait_total = run_idle(0, &wait_blocked);
+	split_total = run_idle(1, &split_blocked);
+
+	printf("pthread_barrier_wait(): %.1f ms blocked, %.1f ms total\n",
+	       wait_blocked, wait_total);
+	printf("arrive and wait_np:     %.1f ms blocked, %.1f ms total\n",
+	       split_blocked, split_total);
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
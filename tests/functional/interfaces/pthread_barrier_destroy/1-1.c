@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_barrier_destroy(pthread_barrier_t *barrier)
+ *
+ *	may be called by the serial thread as soon as pthread_barrier_wait()
+ *	returns, while the other threads are still on their way out.
+ *
+ * Steps:
+ * 1.  For every barrier type, run NUM_OF_ROUNDS rounds in which
+ *     NUM_OF_THREADS threads wait on a freshly initialized barrier once.
+ * 2.  The serial thread destroys the barrier right away and posts the
+ *     round as done.
+ * 3.  Every round should complete, a thread lost in a destroyed barrier
+ *     would hold up the next one.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define NUM_OF_THREADS 8
+#define NUM_OF_ROUNDS  2000
+
+static pthread_barrier_t barrier;
+static pthread_barrier_t round_start;
+static volatile LONG failures = 0;
+static HANDLE done;
+
+static void* fn_chld(void *arg)
+{
+	int i, rc;
+
+	for (i = 0; i < NUM_OF_ROUNDS; i++) {
+		/* Main initializes 'barrier' before this one opens */
+		pthread_barrier_wait(&round_start);
+
+		rc = pthread_barrier_wait(&barrier);
+		if (rc == PTHREAD_BARRIER_SERIAL_THREAD) {
+			if (pthread_barrier_destroy(&barrier) != 0)
+				InterlockedIncrement(&failures);
+			SetEvent(done);
+		} else if (rc != 0) {
+			InterlockedIncrement(&failures);
+		}
+	}
+
+	return NULL;
+}
+
+static int run(int type)
+{
+	pthread_barrierattr_t attr;
+	pthread_t threads[NUM_OF_THREADS];
+	int i;
+
+	if (pthread_barrierattr_init(&attr) != 0 ||
+			pthread_barrierattr_settype_np(&attr, type) != 0 ||
+			pthread_barrier_init(&round_start, NULL,
+					NUM_OF_THREADS + 1) != 0) {
+		printf("Error setting up the barriers\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn_chld, NULL) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	for (i = 0; i < NUM_OF_ROUNDS; i++) {
+		if (pthread_barrier_init(&barrier, &attr, NUM_OF_THREADS) != 0) {
+			printf("Error at pthread_barrier_init()\n");
+			exit(PTS_UNRESOLVED);
+		}
+
+		pthread_barrier_wait(&round_start);
+
+		if (WaitForSingleObject(done, 10000) != WAIT_OBJECT_0) {
+			printf("Test FAILED: round %d did not complete\n", i);
+			exit(PTS_FAIL);
+		}
+	}
+
+	for (i = 0; i < NUM_OF_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&round_start);
+	pthread_barrierattr_destroy(&attr);
+	return failures == 0;
+}
+
+int main()
+{
+	done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!done) {
+		printf("Error at CreateEvent()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (!run(PTHREAD_BARRIER_CENTRAL_NP)) {
+		printf("Test FAILED: central barrier destroy failed\n");
+		return PTS_FAIL;
+	}
+
+	if (!run(PTHREAD_BARRIER_TREE_NP)) {
+		printf("Test FAILED: tree barrier destroy failed\n");
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
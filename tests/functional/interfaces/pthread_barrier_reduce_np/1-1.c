@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_barrier_reduce_np(pthread_barrier_t *barrier,
+ *	const void *value, void *result)
+ *
+ *	hands every thread the reduction of the values passed in the phase,
+ *	and that the completion callback runs once per phase before anybody
+ *	is released.
+ *
+ * Steps:
+ * 1.  A reducing barrier summing long longs with a completion callback is
+ *     initialized for THREADS threads; a tree barrier with a reduction
+ *     should get ENOTSUP.
+ * 2.  For ROUNDS rounds, thread i passes (i + 1) * round.
+ * 3.  Every thread should get round * THREADS * (THREADS + 1) / 2 back,
+ *     and the completion callback should see the same sum while no
+ *     thread has left the round yet.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define THREADS		8
+#define ROUNDS		1000
+
+static pthread_barrier_t barrier;
+static volatile long left[THREADS];
+static volatile long completions;
+static volatile long failures;
+
+static void sum(void *accumulator, const void *value)
+{
+	*(long long *)accumulator += *(const long long *)value;
+}
+
+static void completion(void *result, void *arg)
+{
+	long round = InterlockedIncrement(&completions);
+	int i;
+
+	if (*(long long *)result != (long long)round * THREADS * (THREADS + 1) / 2)
+		InterlockedIncrement(&failures);
+
+	for (i = 0; i < THREADS; i++) {
+		if (left[i] >= round)
+			InterlockedIncrement(&failures);
+	}
+}
+
+static void* fn(void *arg)
+{
+	int index = (int)(size_t)arg;
+	long long value, result;
+	int i, rc;
+
+	for (i = 1; i <= ROUNDS; i++) {
+		value = (long long)(index + 1) * i;
+		rc = pthread_barrier_reduce_np(&barrier, &value, &result);
+		if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD)
+			InterlockedIncrement(&failures);
+
+		if (result != (long long)i * THREADS * (THREADS + 1) / 2)
+			InterlockedIncrement(&failures);
+
+		left[index] = i;
+	}
+
+	return NULL;
+}
+
+int main()
+{
+	pthread_barrierattr_t attr;
+	pthread_t threads[THREADS];
+	int i, rc;
+
+	if (pthread_barrierattr_init(&attr) != 0 ||
+	    pthread_barrierattr_setreduce_np(&attr, sizeof(long long), sum) != 0 ||
+	    pthread_barrierattr_setcompletion_np(&attr, completion, NULL) != 0) {
+		printf("Error setting barrier attributes\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_barrierattr_settype_np(&attr, PTHREAD_BARRIER_TREE_NP) != 0) {
+		printf("Error at pthread_barrierattr_settype_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_barrier_init(&barrier, &attr, THREADS);
+	if (rc != ENOTSUP) {
+		printf("Test FAILED: expected ENOTSUP for a reducing tree barrier, "
+		       "got %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	pthread_barrierattr_settype_np(&attr, PTHREAD_BARRIER_CENTRAL_NP);
+
+	if (pthread_barrier_init(&barrier, &attr, THREADS) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	pthread_barrierattr_destroy(&attr);
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn, (void *)(size_t)i) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (failures != 0 || completions != ROUNDS) {
+		printf("Test FAILED: %ld failures, %ld completions for %d rounds\n",
+		       failures, completions, ROUNDS);
+		return PTS_FAIL;
+	}
+
+	if (pthread_barrier_destroy(&barrier) != 0) {
+		printf("Error at pthread_barrier_destroy()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that a barrier initialized with PTHREAD_PROCESS_SHARED
+ *
+ *	synchronizes processes mapping the same memory, and that exactly one
+ *	of them gets PTHREAD_BARRIER_SERIAL_THREAD per round.
+ *
+ * Steps:
+ * 1.  Main process creates a named file mapping and initializes a process
+ *     shared 'barrier' for three parties in it.
+ * 2.  Main process starts two copies of itself that open the mapping.
+ * 3.  For every round, each process publishes the round it is in and
+ *     waits on the barrier, then checks that no process is behind.
+ * 4.  The serial thread count should equal the number of rounds.
+ */
+#define _XOPEN_SOURCE 600
+#include <windows.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define PROCESSES	3
+#define ROUNDS		1000
+
+struct shared {
+	pthread_barrier_t barrier;
+	volatile long round[PROCESSES];
+	volatile long serials;
+	volatile long behind;
+};
+
+static int run(struct shared *shm, int index)
+{
+	int i, j, rc;
+
+	for (i = 1; i <= ROUNDS; i++) {
+		shm->round[index] = i;
+
+		rc = pthread_barrier_wait(&shm->barrier);
+		if (rc == PTHREAD_BARRIER_SERIAL_THREAD)
+			InterlockedIncrement(&shm->serials);
+		else if (rc != 0)
+			return PTS_FAIL;
+
+		for (j = 0; j < PROCESSES; j++) {
+			if (shm->round[j] < i)
+				InterlockedIncrement(&shm->behind);
+		}
+	}
+
+	return PTS_PASS;
+}
+
+static struct shared *map(HANDLE mapping)
+{
+	return (struct shared *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS,
+					      0, 0, sizeof(struct shared));
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_barrierattr_t attr;
+	PROCESS_INFORMATION pi[PROCESSES - 1];
+	STARTUPINFOA si;
+	struct shared *shm;
+	HANDLE mapping;
+	DWORD status;
+	char name[64], path[MAX_PATH], cmdline[MAX_PATH + 80];
+	int i, rc;
+
+	if (argc > 2) {
+		mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, argv[1]);
+		if (!mapping || !(shm = map(mapping)))
+			return PTS_UNRESOLVED;
+		return run(shm, atoi(argv[2]));
+	}
+
+	snprintf(name, sizeof(name), "Local\\slim-pthread-barrier-test-%lu",
+		 (unsigned long)GetCurrentProcessId());
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+				     0, sizeof(struct shared), name);
+	if (!mapping || !(shm = map(mapping))) {
+		printf("Error creating the shared mapping\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_barrierattr_init(&attr) != 0 ||
+	    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0) {
+		printf("Error at pthread_barrierattr_setpshared()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_barrier_init(&shm->barrier, &attr, PROCESSES);
+	if (rc != 0) {
+		printf("Test FAILED: pthread_barrier_init() returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	pthread_barrierattr_destroy(&attr);
+
+	GetModuleFileNameA(NULL, path, sizeof(path));
+
+	for (i = 0; i < PROCESSES - 1; i++) {
+		snprintf(cmdline, sizeof(cmdline), "\"%s\" %s %d",
+			 path, name, i + 1);
+		ZeroMemory(&si, sizeof(si));
+		si.cb = sizeof(si);
+		if (!CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, 0,
+				    NULL, NULL, &si, &pi[i])) {
+			printf("Error at CreateProcess()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	rc = run(shm, 0);
+
+	for (i = 0; i < PROCESSES - 1; i++) {
+		WaitForSingleObject(pi[i].hProcess, INFINITE);
+		GetExitCodeProcess(pi[i].hProcess, &status);
+		CloseHandle(pi[i].hProcess);
+		CloseHandle(pi[i].hThread);
+		if (status != PTS_PASS)
+			rc = PTS_FAIL;
+	}
+
+	if (rc != PTS_PASS) {
+		printf("Test FAILED: a process failed at pthread_barrier_wait()\n");
+		return PTS_FAIL;
+	}
+
+	if (shm->behind != 0) {
+		printf("Test FAILED: %ld processes left the barrier early\n",
+		       shm->behind);
+		return PTS_FAIL;
+	}
+
+	if (shm->serials != ROUNDS) {
+		printf("Test FAILED: expected %d serial threads, got %ld\n",
+		       ROUNDS, shm->serials);
+		return PTS_FAIL;
+	}
+
+	if (pthread_barrier_destroy(&shm->barrier) != 0) {
+		printf("Error at pthread_barrier_destroy()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
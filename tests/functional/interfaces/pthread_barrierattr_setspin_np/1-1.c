@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_barrierattr_setspin_np(pthread_barrierattr_t *attr,
+ *	int spin)
+ *
+ *	sets how long barrier waiters poll before blocking, and that barriers
+ *	keep their semantics whatever the spin count.
+ *
+ * Steps:
+ * 1.  Check the default spin count and that negative counts other than
+ *     PTHREAD_BARRIER_SPIN_DEFAULT_NP get EINVAL.
+ * 2.  For spin counts of 0 (always block) and 1000000 (practically never
+ *     block), run THREADS threads through ROUNDS barrier rounds.
+ * 3.  After every round no thread should be behind, and exactly one
+ *     thread per round should get PTHREAD_BARRIER_SERIAL_THREAD.
+ * 4.  For 2 to MAX_TIMED threads, with the default spin count and with
+ *     none, time TIMED_ROUNDS empty phases and print the average phase
+ *     latency.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define THREADS		8
+#define ROUNDS		2000
+#define MAX_TIMED	64
+#define TIMED_ROUNDS	1000
+
+static pthread_barrier_t barrier;
+static volatile long round[THREADS];
+static volatile long serials;
+static volatile long behind;
+static volatile long failures;
+
+static void* fn(void *arg)
+{
+	int index = (int)(size_t)arg;
+	int i, j, rc;
+
+	for (i = 1; i <= ROUNDS; i++) {
+		round[index] = i;
+
+		rc = pthread_barrier_wait(&barrier);
+		if (rc == PTHREAD_BARRIER_SERIAL_THREAD)
+			InterlockedIncrement(&serials);
+		else if (rc != 0)
+			InterlockedIncrement(&failures);
+
+		for (j = 0; j < THREADS; j++) {
+			if (round[j] < i)
+				InterlockedIncrement(&behind);
+		}
+	}
+
+	return NULL;
+}
+
+static void* fn_timed(void *arg)
+{
+	int i;
+
+	/* One more round than main, which only times after the first */
+	for (i = 0; i <= TIMED_ROUNDS; i++)
+		pthread_barrier_wait(&barrier);
+
+	return NULL;
+}
+
+/* Returns the average phase latency in microseconds, main takes part */
+static double phase_latency(int spin, int count)
+{
+	pthread_barrierattr_t attr;
+	pthread_t threads[MAX_TIMED];
+	LARGE_INTEGER freq, before, after;
+	int i;
+
+	if (pthread_barrierattr_init(&attr) != 0 ||
+	    pthread_barrierattr_setspin_np(&attr, spin) != 0 ||
+	    pthread_barrier_init(&barrier, &attr, count) != 0) {
+		printf("Error initializing barrier with spin %d\n", spin);
+		exit(PTS_UNRESOLVED);
+	}
+
+	pthread_barrierattr_destroy(&attr);
+
+	for (i = 1; i < count; i++) {
+		if (pthread_create(&threads[i], NULL, fn_timed, NULL) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	QueryPerformanceFrequency(&freq);
+	pthread_barrier_wait(&barrier);
+	QueryPerformanceCounter(&before);
+
+	for (i = 0; i < TIMED_ROUNDS; i++)
+		pthread_barrier_wait(&barrier);
+
+	QueryPerformanceCounter(&after);
+
+	for (i = 1; i < count; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&barrier);
+
+	return (after.QuadPart - before.QuadPart) * 1e6 / freq.QuadPart /
+	       TIMED_ROUNDS;
+}
+
+static int run(int spin)
+{
+	pthread_barrierattr_t attr;
+	pthread_t threads[THREADS];
+	int i;
+
+	serials = behind = failures = 0;
+	for (i = 0; i < THREADS; i++)
+		round[i] = 0;
+
+	if (pthread_barrierattr_init(&attr) != 0 ||
+	    pthread_barrierattr_setspin_np(&attr, spin) != 0 ||
+	    pthread_barrier_init(&barrier, &attr, THREADS) != 0) {
+		printf("Error initializing barrier with spin %d\n", spin);
+		exit(PTS_UNRESOLVED);
+	}
+
+	pthread_barrierattr_destroy(&attr);
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn, (void *)(size_t)i) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&barrier);
+
+	if (failures != 0 || behind != 0 || serials != ROUNDS) {
+		printf("Test FAILED: spin %d: %ld failures, %ld early exits, "
+		       "%ld serial threads for %d rounds\n",
+		       spin, failures, behind, serials, ROUNDS);
+		return PTS_FAIL;
+	}
+
+	return PTS_PASS;
+}
+
+int main()
+{
+	pthread_barrierattr_t attr;
+	int spin, rc, i;
+
+	if (pthread_barrierattr_init(&attr) != 0) {
+		printf("Error at pthread_barrierattr_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_barrierattr_getspin_np(&attr, &spin) != 0 ||
+	    spin != PTHREAD_BARRIER_SPIN_DEFAULT_NP) {
+		printf("Test FAILED: expected the default spin count, got %d\n",
+		       spin);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_barrierattr_setspin_np(&attr, -2);
+	if (rc != EINVAL) {
+		printf("Test FAILED: expected EINVAL for spin -2, got %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	pthread_barrierattr_destroy(&attr);
+
+	if (run(0) != PTS_PASS || run(1000000) != PTS_PASS)
+		return PTS_FAIL;
+
+	printf("threads  default spin  no spin (us per phase)\n");
+	for (i = 2; i <= MAX_TIMED; i *= 2) {
+		printf("%7d  %12.2f  %7.2f\n", i,
+		       phase_latency(PTHREAD_BARRIER_SPIN_DEFAULT_NP, i),
+		       phase_latency(0, i));
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_barrierattr_settype_np(pthread_barrierattr_t *attr,
+ *	int type)
+ *
+ *	with PTHREAD_BARRIER_TREE_NP gives barriers with the same semantics
+ *	as the default central ones.
+ *
+ * Steps:
+ * 1.  Unknown types should get EINVAL, and a process shared tree barrier
+ *     should get ENOTSUP.
+ * 2.  A tree barrier for one thread should return
+ *     PTHREAD_BARRIER_SERIAL_THREAD every time.
+ * 3.  THREADS threads, not a multiple of the tree fan-in, go through
+ *     ROUNDS rounds of a tree barrier. After every round no thread should
+ *     be behind, and exactly one per round should be the serial thread.
+ * 4.  For 2 to MAX_TIMED threads, time TIMED_ROUNDS empty phases of a
+ *     central and of a tree barrier and print both average latencies.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define THREADS		37
+#define ROUNDS		500
+#define MAX_TIMED	64
+#define TIMED_ROUNDS	1000
+
+static pthread_barrier_t barrier;
+static volatile long round[THREADS];
+static volatile long serials;
+static volatile long behind;
+static volatile long failures;
+
+static void* fn(void *arg)
+{
+	int index = (int)(size_t)arg;
+	int i, j, rc;
+
+	for (i = 1; i <= ROUNDS; i++) {
+		round[index] = i;
+
+		rc = pthread_barrier_wait(&barrier);
+		if (rc == PTHREAD_BARRIER_SERIAL_THREAD)
+			InterlockedIncrement(&serials);
+		else if (rc != 0)
+			InterlockedIncrement(&failures);
+
+		for (j = 0; j < THREADS; j++) {
+			if (round[j] < i)
+				InterlockedIncrement(&behind);
+		}
+	}
+
+	return NULL;
+}
+
+static void* fn_timed(void *arg)
+{
+	int i;
+
+	/* One more round than main, which only times after the first */
+	for (i = 0; i <= TIMED_ROUNDS; i++)
+		pthread_barrier_wait(&barrier);
+
+	return NULL;
+}
+
+/* Returns the average phase latency in microseconds, main takes part */
+static double phase_latency(int type, int count)
+{
+	pthread_barrierattr_t attr;
+	pthread_t threads[MAX_TIMED];
+	LARGE_INTEGER freq, before, after;
+	int i;
+
+	if (pthread_barrierattr_init(&attr) != 0 ||
+	    pthread_barrierattr_settype_np(&attr, type) != 0 ||
+	    pthread_barrier_init(&barrier, &attr, count) != 0) {
+		printf("Error initializing barrier of type %d\n", type);
+		exit(PTS_UNRESOLVED);
+	}
+
+	pthread_barrierattr_destroy(&attr);
+
+	for (i = 1; i < count; i++) {
+		if (pthread_create(&threads[i], NULL, fn_timed, NULL) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	QueryPerformanceFrequency(&freq);
+	pthread_barrier_wait(&barrier);
+	QueryPerformanceCounter(&before);
+
+	for (i = 0; i < TIMED_ROUNDS; i++)
+		pthread_barrier_wait(&barrier);
+
+	QueryPerformanceCounter(&after);
+
+	for (i = 1; i < count; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&barrier);
+
+	return (after.QuadPart - before.QuadPart) * 1e6 / freq.QuadPart /
+	       TIMED_ROUNDS;
+}
+
+int main()
+{
+	pthread_barrierattr_t attr;
+	pthread_t threads[THREADS];
+	int i, rc;
+
+	if (pthread_barrierattr_init(&attr) != 0) {
+		printf("Error at pthread_barrierattr_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_barrierattr_settype_np(&attr, 42);
+	if (rc != EINVAL) {
+		printf("Test FAILED: expected EINVAL for type 42, got %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	if (pthread_barrierattr_settype_np(&attr, PTHREAD_BARRIER_TREE_NP) != 0 ||
+	    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0) {
+		printf("Error setting barrier attributes\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_barrier_init(&barrier, &attr, THREADS);
+	if (rc != ENOTSUP) {
+		printf("Test FAILED: expected ENOTSUP for a shared tree barrier, "
+		       "got %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_PRIVATE);
+
+	if (pthread_barrier_init(&barrier, &attr, 1) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < 3; i++) {
+		rc = pthread_barrier_wait(&barrier);
+		if (rc != PTHREAD_BARRIER_SERIAL_THREAD) {
+			printf("Test FAILED: single thread barrier returned %d\n",
+			       rc);
+			return PTS_FAIL;
+		}
+	}
+
+	pthread_barrier_destroy(&barrier);
+
+	if (pthread_barrier_init(&barrier, &attr, THREADS) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	pthread_barrierattr_destroy(&attr);
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn, (void *)(size_t)i) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (failures != 0 || behind != 0 || serials != ROUNDS) {
+		printf("Test FAILED: %ld failures, %ld early exits, "
+		       "%ld serial threads for %d rounds\n",
+		       failures, behind, serials, ROUNDS);
+		return PTS_FAIL;
+	}
+
+	if (pthread_barrier_destroy(&barrier) != 0) {
+		printf("Error at pthread_barrier_destroy()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("threads  central     tree (us per phase)\n");
+	for (i = 2; i <= MAX_TIMED; i *= 2) {
+		printf("%7d  %7.2f  %7.2f\n", i,
+		       phase_latency(PTHREAD_BARRIER_CENTRAL_NP, i),
+		       phase_latency(PTHREAD_BARRIER_TREE_NP, i));
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
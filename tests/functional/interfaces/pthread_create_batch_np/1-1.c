@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_create_batch_np(pthread_t *threads,
+ *                                   const pthread_attr_t *attr,
+ *                                   const pthread_start_np *starts,
+ *                                   unsigned int count, int flags)
+ *
+ *	creates count threads, each running its own start routine and
+ *	argument, and with PTHREAD_CREATE_BATCH_SYNC_NP holds them all until
+ *	the last one exists.
+ *
+ * Steps:
+ * 1.  An empty batch or a NULL start routine should get EINVAL.
+ * 2.  Create NUM_OF_THREADS threads with PTHREAD_CREATE_BATCH_SYNC_NP.
+ *     Each one checks that the last slot of 'threads' is already filled
+ *     in and that pthread_self() is its own slot.
+ * 3.  Join all threads, each should return its argument.
+ * 4.  Start the same number of threads with pthread_create() one after
+ *     another, and print how long each way took from the first call
+ *     until the last thread was running.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define NUM_OF_THREADS 128
+
+static pthread_t threads[NUM_OF_THREADS];
+static volatile long failed = 0;
+static volatile long running = 0;
+static LARGE_INTEGER all_running;
+
+static void count_running(void)
+{
+	if (InterlockedIncrement(&running) == NUM_OF_THREADS)
+		QueryPerformanceCounter(&all_running);
+}
+
+static void* fn_chld(void *arg)
+{
+	long index = (long)arg;
+
+	count_running();
+	if (threads[NUM_OF_THREADS - 1] == NULL ||
+			!pthread_equal(pthread_self(), threads[index]))
+		InterlockedIncrement(&failed);
+
+	return arg;
+}
+
+static void* fn_serial(void *arg)
+{
+	count_running();
+	return arg;
+}
+
+static void join_all(void)
+{
+	void *value;
+	long i;
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		if (pthread_join(threads[i], &value) != 0) {
+			printf("Error at pthread_join()\n");
+			exit(PTS_UNRESOLVED);
+		}
+
+		if ((long)value != i) {
+			printf("Test FAILED: thread %ld returned %p\n", i, value);
+			exit(PTS_FAIL);
+		}
+	}
+}
+
+int main()
+{
+	pthread_start_np starts[NUM_OF_THREADS];
+	LARGE_INTEGER freq, before;
+	double batch_us, serial_us;
+	long i;
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		starts[i].start_routine = fn_chld;
+		starts[i].arg = (void *)i;
+	}
+
+	if (pthread_create_batch_np(threads, NULL, starts, 0, 0) != EINVAL) {
+		printf("Test FAILED: empty batch did not get EINVAL\n");
+		return PTS_FAIL;
+	}
+
+	starts[1].start_routine = NULL;
+	if (pthread_create_batch_np(threads, NULL, starts, 2, 0) != EINVAL) {
+		printf("Test FAILED: NULL start routine did not get EINVAL\n");
+		return PTS_FAIL;
+	}
+	starts[1].start_routine = fn_chld;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&before);
+
+	if (pthread_create_batch_np(threads, NULL, starts, NUM_OF_THREADS,
+			PTHREAD_CREATE_BATCH_SYNC_NP) != 0) {
+		printf("Error at pthread_create_batch_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	join_all();
+	batch_us = (all_running.QuadPart - before.QuadPart) * 1e6 /
+			freq.QuadPart;
+
+	if (failed != 0) {
+		printf("Test FAILED: %ld threads started before the batch existed\n",
+				failed);
+		return PTS_FAIL;
+	}
+
+	running = 0;
+	QueryPerformanceCounter(&before);
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn_serial, (void *)i) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	join_all();
+	serial_us = (all_running.QuadPart - before.QuadPart) * 1e6 /
+			freq.QuadPart;
+
+	printf("%d threads running after %.0f us as a batch, %.0f us one by "
+			"one\n", NUM_OF_THREADS, batch_us, serial_us);
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_exit(void *value_ptr)
+ *
+ *	runs thread specific data destructors without holding a library
+ *	lock: a slow destructor blocks neither other exiting threads nor
+ *	pthread_key_create().
+ *
+ * Steps:
+ * 1.  Create 'slow_key' whose destructor blocks until released, and
+ *     'fast_key' whose destructor counts its calls.
+ * 2.  A child thread sets 'slow_key' and exits, main waits until its
+ *     destructor runs.
+ * 3.  While it is blocked, NUM_OF_THREADS child threads set 'fast_key'
+ *     and exit, they all should be joined.
+ * 4.  While it is blocked, pthread_key_create() should succeed.
+ * 5.  Release the slow destructor and join its thread.
+ * 6.  NUM_OF_EXITING threads each set NUM_OF_KEYS keys, meet on a barrier
+ *     and exit together. Every destructor should run, print the time from
+ *     the barrier opening until the last one returned.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define NUM_OF_THREADS 64
+#define NUM_OF_EXITING 256
+#define NUM_OF_KEYS    16
+
+static pthread_key_t slow_key, fast_key;
+static HANDLE slow_entered, slow_release;
+static volatile long fast_calls = 0;
+
+static pthread_key_t exit_keys[NUM_OF_KEYS];
+static pthread_barrier_t exit_barrier;
+static volatile long exit_calls = 0;
+static LARGE_INTEGER exit_done;
+
+static void slow_destructor(void *value)
+{
+	SetEvent(slow_entered);
+	WaitForSingleObject(slow_release, INFINITE);
+}
+
+static void fast_destructor(void *value)
+{
+	InterlockedIncrement(&fast_calls);
+}
+
+static void exit_destructor(void *value)
+{
+	if (InterlockedIncrement(&exit_calls) == NUM_OF_EXITING * NUM_OF_KEYS)
+		QueryPerformanceCounter(&exit_done);
+}
+
+static void* fn_exiting(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NUM_OF_KEYS; i++)
+		pthread_setspecific(exit_keys[i], (void *)1);
+
+	pthread_barrier_wait(&exit_barrier);
+	pthread_exit(NULL);
+	return NULL;
+}
+
+/* Returns the microseconds until every destructor of every thread ran */
+static double exit_together(void)
+{
+	static pthread_t threads[NUM_OF_EXITING];
+	LARGE_INTEGER freq, before;
+	int i;
+
+	for (i = 0; i < NUM_OF_KEYS; i++) {
+		if (pthread_key_create(&exit_keys[i], exit_destructor) != 0) {
+			printf("Error at pthread_key_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	if (pthread_barrier_init(&exit_barrier, NULL,
+			NUM_OF_EXITING + 1) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	for (i = 0; i < NUM_OF_EXITING; i++) {
+		if (pthread_create(&threads[i], NULL, fn_exiting, NULL) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	QueryPerformanceFrequency(&freq);
+	pthread_barrier_wait(&exit_barrier);
+	QueryPerformanceCounter(&before);
+
+	for (i = 0; i < NUM_OF_EXITING; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&exit_barrier);
+	for (i = 0; i < NUM_OF_KEYS; i++)
+		pthread_key_delete(exit_keys[i]);
+
+	if (exit_calls != NUM_OF_EXITING * NUM_OF_KEYS) {
+		printf("Test FAILED: %ld destructor calls, expected %d\n",
+				exit_calls, NUM_OF_EXITING * NUM_OF_KEYS);
+		exit(PTS_FAIL);
+	}
+
+	return (exit_done.QuadPart - before.QuadPart) * 1e6 / freq.QuadPart;
+}
+
+static void* fn_slow(void *arg)
+{
+	pthread_setspecific(slow_key, (void *)1);
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static void* fn_fast(void *arg)
+{
+	pthread_setspecific(fast_key, (void *)1);
+	pthread_exit(NULL);
+	return NULL;
+}
+
+int main()
+{
+	pthread_t slow_thread, threads[NUM_OF_THREADS];
+	pthread_key_t key;
+	int i;
+
+	slow_entered = CreateEvent(NULL, TRUE, FALSE, NULL);
+	slow_release = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!slow_entered || !slow_release) {
+		printf("Error at CreateEvent()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_key_create(&slow_key, slow_destructor) != 0 ||
+			pthread_key_create(&fast_key, fast_destructor) != 0) {
+		printf("Error at pthread_key_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_create(&slow_thread, NULL, fn_slow, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (WaitForSingleObject(slow_entered, 10000) != WAIT_OBJECT_0) {
+		printf("Error: slow destructor was not called\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn_fast, NULL) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		if (pthread_join(threads[i], NULL) != 0) {
+			printf("Error at pthread_join()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	if (fast_calls != NUM_OF_THREADS) {
+		printf("Test FAILED: %ld fast destructor calls, expected %d\n",
+				fast_calls, NUM_OF_THREADS);
+		return PTS_FAIL;
+	}
+
+	if (pthread_key_create(&key, NULL) != 0) {
+		printf("Test FAILED: pthread_key_create() failed\n");
+		return PTS_FAIL;
+	}
+
+	SetEvent(slow_release);
+
+	if (pthread_join(slow_thread, NULL) != 0) {
+		printf("Error at pthread_join()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("%d threads with %d keys each exited in %.0f us\n",
+			NUM_OF_EXITING, NUM_OF_KEYS, exit_together());
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
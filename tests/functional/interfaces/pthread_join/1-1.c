@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_join(pthread_t thread, void **value_ptr)
+ *
+ *	and pthread_detach() release the OS thread handle, so creating
+ *	threads does not grow the handle count of the process.
+ *
+ * Steps:
+ * 1.  Create and join 1M threads one after another, each returning its
+ *     argument, and check every exit value.
+ * 2.  Create detached threads and threads detached after creation, and
+ *     wait for all of them to finish.
+ * 3.  The process handle count should be back to about where it started.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define NUM_OF_JOINED   1000000
+#define NUM_OF_DETACHED 10000
+
+/* Handles the loader or CRT may keep around, not one per thread */
+#define HANDLE_SLACK    16
+
+static volatile LONG finished = 0;
+
+static void* fn_chld(void *arg)
+{
+	return arg;
+}
+
+static void* fn_detached(void *arg)
+{
+	InterlockedIncrement(&finished);
+	return NULL;
+}
+
+static DWORD handle_count(void)
+{
+	DWORD count = 0;
+
+	if (!GetProcessHandleCount(GetCurrentProcess(), &count)) {
+		printf("Error at GetProcessHandleCount()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	return count;
+}
+
+int main()
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	void *thread_rc;
+	DWORD before, after;
+	long i;
+
+	/* Let the library set up whatever it keeps for the process */
+	if (pthread_create(&thread, NULL, fn_chld, NULL) != 0 ||
+			pthread_join(thread, NULL) != 0) {
+		printf("Error creating the first thread\n");
+		return PTS_UNRESOLVED;
+	}
+
+	before = handle_count();
+
+	for (i = 0; i < NUM_OF_JOINED; i++) {
+		if (pthread_create(&thread, NULL, fn_chld, (void *)i) != 0) {
+			printf("Error at pthread_create() for thread %ld\n", i);
+			return PTS_UNRESOLVED;
+		}
+
+		if (pthread_join(thread, &thread_rc) != 0) {
+			printf("Test FAILED: pthread_join() failed for thread %ld\n", i);
+			return PTS_FAIL;
+		}
+
+		if ((long)thread_rc != i) {
+			printf("Test FAILED: thread %ld returned %ld\n", i,
+					(long)thread_rc);
+			return PTS_FAIL;
+		}
+	}
+
+	if (pthread_attr_init(&attr) != 0 ||
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0) {
+		printf("Error setting up the thread attributes\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < NUM_OF_DETACHED; i++) {
+		if (pthread_create(&thread, (i & 1) ? NULL : &attr, fn_detached,
+				NULL) != 0) {
+			printf("Error at pthread_create() for thread %ld\n", i);
+			return PTS_UNRESOLVED;
+		}
+
+		if ((i & 1) && pthread_detach(thread) != 0) {
+			printf("Test FAILED: pthread_detach() failed for thread %ld\n",
+					i);
+			return PTS_FAIL;
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+
+	while (finished < NUM_OF_DETACHED)
+		Sleep(10);
+
+	/* Give the last detached threads time to run their cleanup */
+	Sleep(500);
+
+	after = handle_count();
+	if (after > before + HANDLE_SLACK) {
+		printf("Test FAILED: handle count grew from %lu to %lu\n",
+				(unsigned long)before, (unsigned long)after);
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
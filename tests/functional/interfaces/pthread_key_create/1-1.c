@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_key_create(pthread_key_t *key, void (*destructor)(void *))
+ *
+ *	is not limited by the Windows TLS slots, and that a key created in
+ *	place of a deleted one does not see the old key's values.
+ *
+ * Steps:
+ * 1.  Main thread creates NUM_OF_KEYS keys, more than Windows has TLS slots.
+ * 2.  Main thread and a child thread set a different value for every key
+ *     and read them back.
+ * 3.  Main thread deletes a key and creates a new one, which reuses the
+ *     index: its value must be NULL.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define NUM_OF_KEYS 4096
+
+static pthread_key_t keys[NUM_OF_KEYS];
+
+static int check_keys(long base)
+{
+	int i;
+
+	for (i = 0; i < NUM_OF_KEYS; i++) {
+		if (pthread_setspecific(keys[i], (void *)(base + i)) != 0) {
+			printf("Error at pthread_setspecific()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; i < NUM_OF_KEYS; i++) {
+		if (pthread_getspecific(keys[i]) != (void *)(base + i)) {
+			printf("Test FAILED: wrong value for key %d\n", i);
+			return PTS_FAIL;
+		}
+	}
+
+	return PTS_PASS;
+}
+
+static void* fn_chld(void *arg)
+{
+	return (void *)(long)check_keys(2 * NUM_OF_KEYS);
+}
+
+int main()
+{
+	pthread_t thread;
+	pthread_key_t key;
+	void *thread_rc;
+	int i, rc;
+
+	for (i = 0; i < NUM_OF_KEYS; i++) {
+		rc = pthread_key_create(&keys[i], NULL);
+		if (rc != 0) {
+			printf("Test FAILED: pthread_key_create() #%d returned %d\n", i, rc);
+			return PTS_FAIL;
+		}
+	}
+
+	rc = check_keys(1);
+	if (rc != PTS_PASS)
+		return rc;
+
+	if (pthread_create(&thread, NULL, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_join(thread, &thread_rc) != 0) {
+		printf("Error at pthread_join()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if ((long)thread_rc != PTS_PASS)
+		return (int)(long)thread_rc;
+
+	/* The child's values must not have leaked into this thread */
+	if (pthread_getspecific(keys[0]) != (void *)1) {
+		printf("Test FAILED: value changed by another thread\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_key_delete(keys[0]) != 0) {
+		printf("Error at pthread_key_delete()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_key_create(&key, NULL) != 0) {
+		printf("Error at pthread_key_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_getspecific(key) != NULL) {
+		printf("Test FAILED: new key sees the value of a deleted key\n");
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_once(pthread_once_t *once_control,
+ *                        void (*init_routine)(void))
+ *
+ *	runs init_routine exactly once however many threads race for it, and
+ *	that later calls return without calling into the library.
+ *
+ * Steps:
+ * 1.  THREADS threads wait on a barrier, then all call pthread_once() on
+ *     the same control. init_routine should have run once, and every
+ *     thread should see its side effect.
+ * 2.  Each thread then calls pthread_once() CALLS times, and once more
+ *     CALLS times through the library slow path __slim_pthread_once().
+ *     Print the calls per second of both.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "posixtest.h"
+
+#define THREADS		8
+#define CALLS		10000000
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_barrier_t barrier;
+static volatile long init_calls = 0;
+static volatile long initialized = 0;
+static volatile long missed = 0;
+static LONGLONG ticks[2][THREADS];
+
+static void init_routine(void)
+{
+	InterlockedIncrement(&init_calls);
+	Sleep(10);
+	initialized = 1;
+}
+
+static void* fn_chld(void *arg)
+{
+	int index = (int)(size_t)arg;
+	LARGE_INTEGER before, after;
+	long i;
+
+	pthread_barrier_wait(&barrier);
+
+	if (pthread_once(&once, init_routine) != 0 || !initialized)
+		InterlockedIncrement(&missed);
+
+	QueryPerformanceCounter(&before);
+	for (i = 0; i < CALLS; i++)
+		pthread_once(&once, init_routine);
+	QueryPerformanceCounter(&after);
+	ticks[0][index] = after.QuadPart - before.QuadPart;
+
+	QueryPerformanceCounter(&before);
+	for (i = 0; i < CALLS; i++)
+		__slim_pthread_once(&once, init_routine);
+	QueryPerformanceCounter(&after);
+	ticks[1][index] = after.QuadPart - before.QuadPart;
+
+	return NULL;
+}
+
+/* Calls per second across all threads */
+static double rate(LONGLONG *thread_ticks, LARGE_INTEGER freq)
+{
+	double seconds = 0;
+	int i;
+
+	for (i = 0; i < THREADS; i++)
+		seconds += (double)thread_ticks[i] / freq.QuadPart;
+
+	return (double)CALLS * THREADS * THREADS / seconds;
+}
+
+int main()
+{
+	pthread_t threads[THREADS];
+	LARGE_INTEGER freq;
+	int i;
+
+	if (pthread_barrier_init(&barrier, NULL, THREADS) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, fn_chld,
+		    (void *)(size_t)i) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&barrier);
+
+	if (init_calls != 1) {
+		printf("Test FAILED: init_routine ran %ld times\n", init_calls);
+		return PTS_FAIL;
+	}
+
+	if (missed != 0) {
+		printf("Test FAILED: %ld threads returned before init_routine "
+		       "finished\n", missed);
+		return PTS_FAIL;
+	}
+
+	QueryPerformanceFrequency(&freq);
+	printf("%d threads: %.0f million calls per second inline, %.0f million "
+	       "through the library\n", THREADS, rate(ticks[0], freq) / 1e6,
+	       rate(ticks[1], freq) / 1e6);
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
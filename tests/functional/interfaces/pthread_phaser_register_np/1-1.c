@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_phaser_register_np(pthread_phaser_t *phaser,
+ *	unsigned int *phase)
+ *
+ *	and pthread_phaser_deregister_np() change the parties of a phaser
+ *	while it is in use.
+ *
+ * Steps:
+ * 1.  With a phaser for two parties, the second arrival should advance
+ *     the phase and get PTHREAD_BARRIER_SERIAL_THREAD.
+ * 2.  A party registering joins the current phase, a party deregistering
+ *     counts as arrived; arriving with no parties left gets EINVAL.
+ * 3.  Main thread registers WORKERS workers that each go through a
+ *     different number of phases before deregistering, while the main
+ *     thread keeps going through phases until all of them left.
+ *     Every party should see consecutive phases.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define WORKERS		8
+
+static pthread_phaser_t phaser;
+static volatile long active = WORKERS;
+static volatile long failures;
+
+static void* fn(void *arg)
+{
+	int phases = 50 + 37 * (int)(size_t)arg;
+	unsigned int phase, last = 0;
+	int i, rc;
+
+	for (i = 0; i < phases; i++) {
+		rc = pthread_phaser_arrive_np(&phaser, &phase);
+		if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD)
+			InterlockedIncrement(&failures);
+
+		if (i > 0 && phase != last + 1)
+			InterlockedIncrement(&failures);
+		last = phase;
+
+		if (pthread_phaser_await_advance_np(&phaser, phase) != 0)
+			InterlockedIncrement(&failures);
+	}
+
+	InterlockedDecrement(&active);
+	pthread_phaser_deregister_np(&phaser, NULL);
+	return NULL;
+}
+
+int main()
+{
+	pthread_t threads[WORKERS];
+	unsigned int phase, last;
+	int i, rc;
+
+	if (pthread_phaser_init_np(&phaser, 2) != 0) {
+		printf("Error at pthread_phaser_init_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_phaser_arrive_np(&phaser, &phase);
+	if (rc != 0 || phase != 0) {
+		printf("Test FAILED: first arrival returned %d in phase %u\n",
+		       rc, phase);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_phaser_arrive_np(&phaser, &phase);
+	if (rc != PTHREAD_BARRIER_SERIAL_THREAD || phase != 0) {
+		printf("Test FAILED: last arrival returned %d in phase %u\n",
+		       rc, phase);
+		return PTS_FAIL;
+	}
+
+	if (pthread_phaser_await_advance_np(&phaser, 0) != 0) {
+		printf("Test FAILED: waiting on a past phase failed\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_phaser_register_np(&phaser, &phase) != 0 || phase != 1) {
+		printf("Test FAILED: registering did not join phase 1\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_phaser_deregister_np(&phaser, NULL) != 0 ||
+	    pthread_phaser_deregister_np(&phaser, NULL) != 0) {
+		printf("Test FAILED: pthread_phaser_deregister_np() failed\n");
+		return PTS_FAIL;
+	}
+
+	rc = pthread_phaser_deregister_np(&phaser, &phase);
+	if (rc != PTHREAD_BARRIER_SERIAL_THREAD || phase != 1) {
+		printf("Test FAILED: last deregistration returned %d in phase %u\n",
+		       rc, phase);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_phaser_arrive_np(&phaser, NULL);
+	if (rc != EINVAL) {
+		printf("Test FAILED: expected EINVAL without parties, got %d\n",
+		       rc);
+		return PTS_FAIL;
+	}
+
+	pthread_phaser_destroy_np(&phaser);
+
+	if (pthread_phaser_init_np(&phaser, 1) != 0) {
+		printf("Error at pthread_phaser_init_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < WORKERS; i++) {
+		if (pthread_phaser_register_np(&phaser, NULL) != 0) {
+			printf("Test FAILED: pthread_phaser_register_np() failed\n");
+			return PTS_FAIL;
+		}
+
+		if (pthread_create(&threads[i], NULL, fn, (void *)(size_t)i) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; active > 0; i++) {
+		rc = pthread_phaser_arrive_np(&phaser, &phase);
+		if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD)
+			InterlockedIncrement(&failures);
+
+		if (i > 0 && phase != last + 1)
+			InterlockedIncrement(&failures);
+		last = phase;
+
+		pthread_phaser_await_advance_np(&phaser, phase);
+	}
+
+	pthread_phaser_deregister_np(&phaser, NULL);
+
+	for (i = 0; i < WORKERS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (failures != 0) {
+		printf("Test FAILED: %ld parties skipped a phase or failed\n",
+		       failures);
+		return PTS_FAIL;
+	}
+
+	if (pthread_phaser_destroy_np(&phaser) != 0) {
+		printf("Error at pthread_phaser_destroy_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
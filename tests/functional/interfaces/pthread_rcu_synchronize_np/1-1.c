@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_rcu_synchronize_np()
+ *
+ *	returns only after every read-side critical section that could
+ *	still see the old version of a published pointer has ended, and that
+ *	pthread_rcu_call_np() callbacks run after a grace period.
+ *
+ * Steps:
+ * 1.  Reader threads repeatedly enter a read section, load the shared
+ *     pointer and check the object it points to is still live.
+ * 2.  The main thread publishes a new object, waits for a grace period
+ *     and then marks the old object dead.
+ * 3.  No reader may observe a dead object.
+ * 4.  Retire objects with pthread_rcu_call_np() and check every callback
+ *     has run once pthread_rcu_barrier_np() returns.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "posixtest.h"
+
+#define READERS		4
+#define UPDATES		2000
+#define LIVE		0x4C495645
+#define DEAD		0x44454144
+
+struct object {
+	volatile long magic;
+};
+
+static struct object *volatile shared;
+static volatile int done;
+static volatile int failed;
+static volatile long retired;
+
+static void* fn_reader(void *arg)
+{
+	struct object *obj;
+
+	while (!done) {
+		pthread_rcu_read_lock_np();
+		obj = shared;
+		if (obj->magic != LIVE)
+			failed = 1;
+		pthread_rcu_read_unlock_np();
+	}
+	return NULL;
+}
+
+static void retire(void *arg)
+{
+	struct object *obj = (struct object *)arg;
+
+	obj->magic = DEAD;
+	free(obj);
+	InterlockedIncrement(&retired);
+}
+
+static struct object* new_object(void)
+{
+	struct object *obj = (struct object *)malloc(sizeof(struct object));
+
+	if (!obj) {
+		printf("Error at malloc()\n");
+		exit(PTS_UNRESOLVED);
+	}
+	obj->magic = LIVE;
+	return obj;
+}
+
+int main()
+{
+	pthread_t readers[READERS];
+	struct object *old;
+	int i;
+
+	shared = new_object();
+
+	for (i = 0; i < READERS; i++) {
+		if (pthread_create(&readers[i], NULL, fn_reader, NULL) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	for (i = 0; i < UPDATES; i++) {
+		old = (struct object *)InterlockedExchangePointer(
+				(PVOID volatile *)&shared, new_object());
+
+		if (i & 1) {
+			if (pthread_rcu_call_np(retire, old) != 0) {
+				printf("Error at pthread_rcu_call_np()\n");
+				return PTS_UNRESOLVED;
+			}
+		} else {
+			if (pthread_rcu_synchronize_np() != 0) {
+				printf("Test FAILED: pthread_rcu_synchronize_np() failed\n");
+				return PTS_FAIL;
+			}
+			old->magic = DEAD;
+			free(old);
+		}
+	}
+
+	if (pthread_rcu_barrier_np() != 0) {
+		printf("Test FAILED: pthread_rcu_barrier_np() failed\n");
+		return PTS_FAIL;
+	}
+
+	done = 1;
+	for (i = 0; i < READERS; i++)
+		pthread_join(readers[i], NULL);
+
+	if (failed) {
+		printf("Test FAILED: reader saw an object freed before its grace period\n");
+		return PTS_FAIL;
+	}
+
+	if (retired != UPDATES / 2) {
+		printf("Test FAILED: %ld of %d deferred callbacks ran\n",
+				retired, UPDATES / 2);
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_rwlock_downgrade_np(pthread_rwlock_t *rwlock)
+ *
+ *	converts a write lock held by the calling thread into a read lock
+ *	without releasing it: other readers may enter, writers may not.
+ *
+ * Steps:
+ * 1.  Main thread write locks 'rwlock' and downgrades it.
+ * 2.  A child thread calls pthread_rwlock_tryrdlock(), it should succeed.
+ * 3.  A child thread calls pthread_rwlock_trywrlock(), it should get EBUSY.
+ * 4.  Main thread unlocks, the child thread write lock should now succeed.
+ * 5.  Downgrading a lock held only for reading should get EPERM.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+static pthread_rwlock_t rwlock;
+static int rd_rc, wr_rc;
+
+static void* fn_rd(void *arg)
+{
+	rd_rc = pthread_rwlock_tryrdlock(&rwlock);
+	if (rd_rc == 0)
+		pthread_rwlock_unlock(&rwlock);
+	return NULL;
+}
+
+static void* fn_wr(void *arg)
+{
+	wr_rc = pthread_rwlock_trywrlock(&rwlock);
+	if (wr_rc == 0)
+		pthread_rwlock_unlock(&rwlock);
+	return NULL;
+}
+
+static void run(void *(*fn)(void *))
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, fn, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	if (pthread_join(thread, NULL) != 0) {
+		printf("Error at pthread_join()\n");
+		exit(PTS_UNRESOLVED);
+	}
+}
+
+int main()
+{
+	int rc;
+
+	if (pthread_rwlock_init(&rwlock, NULL) != 0) {
+		printf("Error at pthread_rwlock_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_rwlock_wrlock(&rwlock) != 0) {
+		printf("Error at pthread_rwlock_wrlock()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_rwlock_downgrade_np(&rwlock);
+	if (rc != 0) {
+		printf("Test FAILED: pthread_rwlock_downgrade_np() returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	run(fn_rd);
+	if (rd_rc != 0) {
+		printf("Test FAILED: reader blocked after downgrade, got %d\n", rd_rc);
+		return PTS_FAIL;
+	}
+
+	run(fn_wr);
+	if (wr_rc != EBUSY) {
+		printf("Test FAILED: expected EBUSY for writer, got %d\n", wr_rc);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_rwlock_downgrade_np(&rwlock);
+	if (rc != EPERM) {
+		printf("Test FAILED: expected EPERM downgrading a read lock, got %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	if (pthread_rwlock_unlock(&rwlock) != 0) {
+		printf("Error at pthread_rwlock_unlock()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	run(fn_wr);
+	if (wr_rc != 0) {
+		printf("Test FAILED: writer failed after unlock, got %d\n", wr_rc);
+		return PTS_FAIL;
+	}
+
+	if (pthread_rwlock_destroy(&rwlock) != 0) {
+		printf("Error at pthread_rwlock_destroy()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_rwlock_getstats_np(pthread_rwlock_t *rwlock,
+ *	struct pthread_rwlock_stats_np *stats)
+ *
+ *	returns the acquisition counters of a lock created with statistics
+ *	enabled through pthread_rwlockattr_setstats_np().
+ *
+ * Steps:
+ * 1.  Create 'rwlock' from an attribute with statistics enabled.
+ * 2.  Read lock it twice and write lock it once from the main thread.
+ * 3.  While the main thread holds a read lock, a child thread calls
+ *     pthread_rwlock_trywrlock(), it should get EBUSY.
+ * 4.  The counters should show 2 reads, 1 write and 1 contended write,
+ *     and the write hold histogram should hold exactly one sample.
+ * 5.  pthread_rwlock_enumstats_np() should visit 'rwlock' and return what
+ *     the callback returned to stop the walk.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+static pthread_rwlock_t rwlock;
+static int wr_rc;
+
+static int stop_at_rwlock(pthread_rwlock_t *lock,
+		const struct pthread_rwlock_stats_np *stats, void *arg)
+{
+	return lock == &rwlock ? 42 : 0;
+}
+
+static void* fn_wr(void *arg)
+{
+	wr_rc = pthread_rwlock_trywrlock(&rwlock);
+	if (wr_rc == 0)
+		pthread_rwlock_unlock(&rwlock);
+	return NULL;
+}
+
+int main()
+{
+	pthread_rwlockattr_t attr;
+	struct pthread_rwlock_stats_np stats;
+	pthread_t thread;
+	unsigned long long samples = 0;
+	int i, rc;
+
+	if (pthread_rwlockattr_init(&attr) != 0) {
+		printf("Error at pthread_rwlockattr_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_rwlockattr_setstats_np(&attr, 1) != 0) {
+		printf("Error at pthread_rwlockattr_setstats_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_rwlock_init(&rwlock, &attr) != 0) {
+		printf("Error at pthread_rwlock_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	pthread_rwlockattr_destroy(&attr);
+
+	if (pthread_rwlock_wrlock(&rwlock) != 0 ||
+	    pthread_rwlock_unlock(&rwlock) != 0 ||
+	    pthread_rwlock_rdlock(&rwlock) != 0 ||
+	    pthread_rwlock_unlock(&rwlock) != 0 ||
+	    pthread_rwlock_rdlock(&rwlock) != 0) {
+		printf("Error locking 'rwlock'\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_create(&thread, NULL, fn_wr, NULL) != 0 ||
+	    pthread_join(thread, NULL) != 0) {
+		printf("Error running child thread\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (wr_rc != EBUSY) {
+		printf("Test FAILED: expected EBUSY for writer, got %d\n", wr_rc);
+		return PTS_FAIL;
+	}
+
+	pthread_rwlock_unlock(&rwlock);
+
+	rc = pthread_rwlock_getstats_np(&rwlock, &stats);
+	if (rc != 0) {
+		printf("Test FAILED: pthread_rwlock_getstats_np() returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	if (stats.rdlocks != 2 || stats.wrlocks != 1 ||
+	    stats.wrlocks_contended != 1) {
+		printf("Test FAILED: got %llu reads, %llu writes, %llu contended\n",
+		       stats.rdlocks, stats.wrlocks, stats.wrlocks_contended);
+		return PTS_FAIL;
+	}
+
+	for (i = 0; i < PTHREAD_RWLOCK_STATS_BUCKETS_NP; i++)
+		samples += stats.wrhold[i];
+
+	if (samples != 1) {
+		printf("Test FAILED: expected 1 write hold sample, got %llu\n",
+		       samples);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_rwlock_enumstats_np(stop_at_rwlock, NULL);
+	if (rc != 42) {
+		printf("Test FAILED: pthread_rwlock_enumstats_np() returned %d\n",
+		       rc);
+		return PTS_FAIL;
+	}
+
+	if (pthread_rwlock_destroy(&rwlock) != 0) {
+		printf("Error at pthread_rwlock_destroy()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
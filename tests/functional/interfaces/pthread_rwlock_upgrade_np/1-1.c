@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_rwlock_upgrade_np(pthread_rwlock_t *rwlock)
+ *
+ *	converts an upgradable read lock held by the calling thread into a
+ *	write lock. While upgradable, plain readers share the lock but other
+ *	upgradable readers and writers are excluded.
+ *
+ * Steps:
+ * 1.  Main thread takes 'rwlock' with pthread_rwlock_uprdlock_np().
+ * 2.  A child thread calls pthread_rwlock_tryrdlock(), it should succeed.
+ * 3.  A child thread calls pthread_rwlock_tryuprdlock_np(), it should get EBUSY.
+ * 4.  Main thread upgrades, child pthread_rwlock_tryrdlock() should get EBUSY.
+ * 5.  Main thread downgrades, child pthread_rwlock_tryrdlock() should succeed.
+ * 6.  Main thread takes a read lock and then an upgradable one on top of
+ *     it, upgrading should get EDEADLK rather than wait on itself.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+static pthread_rwlock_t rwlock;
+static int rd_rc, up_rc;
+
+static void* fn_rd(void *arg)
+{
+	rd_rc = pthread_rwlock_tryrdlock(&rwlock);
+	if (rd_rc == 0)
+		pthread_rwlock_unlock(&rwlock);
+	return NULL;
+}
+
+static void* fn_up(void *arg)
+{
+	up_rc = pthread_rwlock_tryuprdlock_np(&rwlock);
+	if (up_rc == 0)
+		pthread_rwlock_unlock(&rwlock);
+	return NULL;
+}
+
+static void run(void *(*fn)(void *))
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, fn, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	if (pthread_join(thread, NULL) != 0) {
+		printf("Error at pthread_join()\n");
+		exit(PTS_UNRESOLVED);
+	}
+}
+
+int main()
+{
+	int rc;
+
+	if (pthread_rwlock_init(&rwlock, NULL) != 0) {
+		printf("Error at pthread_rwlock_init()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_rwlock_uprdlock_np(&rwlock);
+	if (rc != 0) {
+		printf("Test FAILED: pthread_rwlock_uprdlock_np() returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	run(fn_rd);
+	if (rd_rc != 0) {
+		printf("Test FAILED: reader blocked by upgradable lock, got %d\n", rd_rc);
+		return PTS_FAIL;
+	}
+
+	run(fn_up);
+	if (up_rc != EBUSY) {
+		printf("Test FAILED: expected EBUSY for second upgradable reader, got %d\n", up_rc);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_rwlock_upgrade_np(&rwlock);
+	if (rc != 0) {
+		printf("Test FAILED: pthread_rwlock_upgrade_np() returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	run(fn_rd);
+	if (rd_rc != EBUSY) {
+		printf("Test FAILED: expected EBUSY for reader after upgrade, got %d\n", rd_rc);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_rwlock_downgrade_np(&rwlock);
+	if (rc != 0) {
+		printf("Test FAILED: pthread_rwlock_downgrade_np() returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	run(fn_rd);
+	if (rd_rc != 0) {
+		printf("Test FAILED: reader blocked after downgrade, got %d\n", rd_rc);
+		return PTS_FAIL;
+	}
+
+	if (pthread_rwlock_unlock(&rwlock) != 0) {
+		printf("Error at pthread_rwlock_unlock()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_rwlock_rdlock(&rwlock) != 0 ||
+			pthread_rwlock_uprdlock_np(&rwlock) != 0) {
+		printf("Error taking the read and upgradable locks\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_rwlock_upgrade_np(&rwlock);
+	if (rc != EDEADLK) {
+		printf("Test FAILED: expected EDEADLK upgrading over a read lock, got %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	rc = pthread_rwlock_tryupgrade_np(&rwlock);
+	if (rc != EDEADLK) {
+		printf("Test FAILED: expected EDEADLK from tryupgrade over a read lock, got %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	if (pthread_rwlock_unlock(&rwlock) != 0 ||
+			pthread_rwlock_unlock(&rwlock) != 0) {
+		printf("Error at pthread_rwlock_unlock()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_rwlock_destroy(&rwlock) != 0) {
+		printf("Error at pthread_rwlock_destroy()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that a rwlock initialized with PTHREAD_PROCESS_SHARED
+ *
+ *	excludes writers of other processes mapping the same memory.
+ *
+ * Steps:
+ * 1.  Main process creates a named file mapping, initializes a process
+ *     shared 'rwlock' and two counters in it.
+ * 2.  Main process starts two copies of itself that open the mapping.
+ * 3.  Every process loops, write locking to bump both counters with a
+ *     yield in between, and read locking to check that they are equal.
+ * 4.  When all processes are done no reader should have seen the
+ *     counters differ and both should hold the total number of writes.
+ */
+#define _XOPEN_SOURCE 600
+#include <windows.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define PROCESSES	3
+#define LOOPS		20000
+
+struct shared {
+	pthread_rwlock_t rwlock;
+	volatile long a;
+	volatile long b;
+	volatile long mismatches;
+};
+
+static int run(struct shared *shm)
+{
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		if (i % 4 == 0) {
+			if (pthread_rwlock_wrlock(&shm->rwlock) != 0)
+				return PTS_FAIL;
+			shm->a++;
+			Sleep(0);
+			shm->b++;
+		} else {
+			if (pthread_rwlock_rdlock(&shm->rwlock) != 0)
+				return PTS_FAIL;
+			if (shm->a != shm->b)
+				InterlockedIncrement(&shm->mismatches);
+		}
+
+		if (pthread_rwlock_unlock(&shm->rwlock) != 0)
+			return PTS_FAIL;
+	}
+
+	return PTS_PASS;
+}
+
+static struct shared *map(HANDLE mapping)
+{
+	return (struct shared *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS,
+					      0, 0, sizeof(struct shared));
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_rwlockattr_t attr;
+	PROCESS_INFORMATION pi[PROCESSES - 1];
+	STARTUPINFOA si;
+	struct shared *shm;
+	HANDLE mapping;
+	DWORD status;
+	char name[64], path[MAX_PATH], cmdline[MAX_PATH + 80];
+	int i, rc;
+
+	if (argc > 1) {
+		mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, argv[1]);
+		if (!mapping || !(shm = map(mapping)))
+			return PTS_UNRESOLVED;
+		return run(shm);
+	}
+
+	snprintf(name, sizeof(name), "Local\\slim-pthread-rwlock-test-%lu",
+		 (unsigned long)GetCurrentProcessId());
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+				     0, sizeof(struct shared), name);
+	if (!mapping || !(shm = map(mapping))) {
+		printf("Error creating the shared mapping\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_rwlockattr_init(&attr) != 0 ||
+	    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0) {
+		printf("Error at pthread_rwlockattr_setpshared()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	rc = pthread_rwlock_init(&shm->rwlock, &attr);
+	if (rc != 0) {
+		printf("Test FAILED: pthread_rwlock_init() returned %d\n", rc);
+		return PTS_FAIL;
+	}
+
+	pthread_rwlockattr_destroy(&attr);
+
+	GetModuleFileNameA(NULL, path, sizeof(path));
+	snprintf(cmdline, sizeof(cmdline), "\"%s\" %s", path, name);
+
+	for (i = 0; i < PROCESSES - 1; i++) {
+		ZeroMemory(&si, sizeof(si));
+		si.cb = sizeof(si);
+		if (!CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, 0,
+				    NULL, NULL, &si, &pi[i])) {
+			printf("Error at CreateProcess()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	rc = run(shm);
+
+	for (i = 0; i < PROCESSES - 1; i++) {
+		WaitForSingleObject(pi[i].hProcess, INFINITE);
+		GetExitCodeProcess(pi[i].hProcess, &status);
+		CloseHandle(pi[i].hProcess);
+		CloseHandle(pi[i].hThread);
+		if (status != PTS_PASS)
+			rc = PTS_FAIL;
+	}
+
+	if (rc != PTS_PASS) {
+		printf("Test FAILED: a process failed to lock or unlock\n");
+		return PTS_FAIL;
+	}
+
+	if (shm->mismatches != 0) {
+		printf("Test FAILED: readers saw %ld half done writes\n",
+		       shm->mismatches);
+		return PTS_FAIL;
+	}
+
+	if (shm->a != PROCESSES * LOOPS / 4 || shm->b != shm->a) {
+		printf("Test FAILED: expected %d writes, got %ld and %ld\n",
+		       PROCESSES * LOOPS / 4, shm->a, shm->b);
+		return PTS_FAIL;
+	}
+
+	if (pthread_rwlock_destroy(&shm->rwlock) != 0) {
+		printf("Error at pthread_rwlock_destroy()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_self()
+ *
+ *	gives threads not created by pthread_create() a descriptor of their
+ *	own, stable for the life of the thread, and that the thread is
+ *	cleaned up at exit.
+ *
+ * Steps:
+ * 1.  Start two threads with CreateThread(). Each calls pthread_self()
+ *     twice, expects the same value both times, then sets 'key' and waits
+ *     for the other thread.
+ * 2.  The two threads should have had different descriptors, neither
+ *     equal to the main thread's.
+ * 3.  The key destructor should have been called once for each thread.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define NUM_OF_THREADS 2
+
+static pthread_key_t key;
+static pthread_barrier_t barrier;
+static pthread_t selves[NUM_OF_THREADS];
+static volatile LONG destructor_calls = 0;
+
+static void destructor(void *value)
+{
+	InterlockedIncrement(&destructor_calls);
+}
+
+static DWORD WINAPI fn_foreign(LPVOID arg)
+{
+	int i = (int)(intptr_t)arg;
+
+	selves[i] = pthread_self();
+	if (!selves[i] || !pthread_equal(selves[i], pthread_self()))
+		selves[i] = NULL;
+
+	pthread_setspecific(key, (void *)1);
+
+	/* Keep both threads alive until each has its descriptor */
+	pthread_barrier_wait(&barrier);
+	return 0;
+}
+
+int main()
+{
+	HANDLE threads[NUM_OF_THREADS];
+	int i;
+
+	if (pthread_key_create(&key, destructor) != 0 ||
+			pthread_barrier_init(&barrier, NULL, NUM_OF_THREADS) != 0) {
+		printf("Error setting up the test\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		threads[i] = CreateThread(NULL, 0, fn_foreign, (LPVOID)(intptr_t)i,
+				0, NULL);
+		if (!threads[i]) {
+			printf("Error at CreateThread()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	WaitForMultipleObjects(NUM_OF_THREADS, threads, TRUE, INFINITE);
+	for (i = 0; i < NUM_OF_THREADS; i++)
+		CloseHandle(threads[i]);
+
+	if (!selves[0] || !selves[1]) {
+		printf("Test FAILED: pthread_self() was not stable\n");
+		return PTS_FAIL;
+	}
+
+	/* The threads are gone, so compare the values only */
+	if (selves[0] == selves[1] || selves[0] == pthread_self() ||
+			selves[1] == pthread_self()) {
+		printf("Test FAILED: threads shared a descriptor\n");
+		return PTS_FAIL;
+	}
+
+	if (destructor_calls != NUM_OF_THREADS) {
+		printf("Test FAILED: destructor called %ld times\n",
+				(long)destructor_calls);
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
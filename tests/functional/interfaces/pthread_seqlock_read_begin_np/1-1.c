@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_seqlock_read_begin_np() / pthread_seqlock_read_retry_np()
+ *
+ *	let readers observe only consistent snapshots of data updated under
+ *	pthread_seqlock_write_lock_np().
+ *
+ * Steps:
+ * 1.  Start a writer thread that repeatedly updates a pair (a, b) keeping
+ *     b == 2 * a, with the second store separated from the first.
+ * 2.  Start reader threads that read the pair inside a read section and
+ *     retry on conflict.
+ * 3.  Every snapshot a reader accepts must satisfy b == 2 * a.
+ * 4.  Have READERS threads each read the pair BENCH_READS times, writing
+ *     it once every WRITE_EVERY reads, first under the seqlock and then
+ *     under a rwlock, and print the time per read for both.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "posixtest.h"
+
+#define READERS		4
+#define UPDATES		100000
+#define BENCH_READS	1000000
+#define WRITE_EVERY	1000
+
+static pthread_seqlock_t seqlock = PTHREAD_SEQLOCK_INITIALIZER_NP;
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_barrier_t start;
+static volatile long pair_a, pair_b;
+static volatile int done;
+static volatile int failed;
+
+static void* fn_writer(void *arg)
+{
+	long i;
+
+	for (i = 1; i <= UPDATES; i++) {
+		pthread_seqlock_write_lock_np(&seqlock);
+		pair_a = i;
+		YieldProcessor();
+		pair_b = i * 2;
+		pthread_seqlock_write_unlock_np(&seqlock);
+	}
+
+	done = 1;
+	return NULL;
+}
+
+static void* fn_reader(void *arg)
+{
+	unsigned int seq;
+	long a, b;
+
+	while (!done) {
+		do {
+			seq = pthread_seqlock_read_begin_np(&seqlock);
+			a = pair_a;
+			b = pair_b;
+		} while (pthread_seqlock_read_retry_np(&seqlock, seq));
+
+		if (b != a * 2) {
+			printf("Test FAILED: torn snapshot a=%ld b=%ld\n", a, b);
+			failed = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void* fn_bench(void *arg)
+{
+	int use_seqlock = (int)(intptr_t)arg;
+	unsigned int seq;
+	long i, a, b;
+
+	pthread_barrier_wait(&start);
+
+	for (i = 1; i <= BENCH_READS; i++) {
+		if (i % WRITE_EVERY == 0) {
+			if (use_seqlock)
+				pthread_seqlock_write_lock_np(&seqlock);
+			else
+				pthread_rwlock_wrlock(&rwlock);
+			pair_a = i;
+			pair_b = i * 2;
+			if (use_seqlock)
+				pthread_seqlock_write_unlock_np(&seqlock);
+			else
+				pthread_rwlock_unlock(&rwlock);
+		}
+
+		if (use_seqlock) {
+			do {
+				seq = pthread_seqlock_read_begin_np(&seqlock);
+				a = pair_a;
+				b = pair_b;
+			} while (pthread_seqlock_read_retry_np(&seqlock, seq));
+		} else {
+			pthread_rwlock_rdlock(&rwlock);
+			a = pair_a;
+			b = pair_b;
+			pthread_rwlock_unlock(&rwlock);
+		}
+
+		if (b != a * 2)
+			failed = 1;
+	}
+
+	return NULL;
+}
+
+/* Returns the nanoseconds per read across all readers */
+static double bench(int use_seqlock)
+{
+	pthread_t readers[READERS];
+	LARGE_INTEGER freq, before, after;
+	int i;
+
+	if (pthread_barrier_init(&start, NULL, READERS + 1) != 0) {
+		printf("Error at pthread_barrier_init()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	for (i = 0; i < READERS; i++) {
+		if (pthread_create(&readers[i], NULL, fn_bench,
+				(void *)(intptr_t)use_seqlock) != 0) {
+			printf("Error at pthread_create()\n");
+			exit(PTS_UNRESOLVED);
+		}
+	}
+
+	QueryPerformanceFrequency(&freq);
+	pthread_barrier_wait(&start);
+	QueryPerformanceCounter(&before);
+
+	for (i = 0; i < READERS; i++)
+		pthread_join(readers[i], NULL);
+
+	QueryPerformanceCounter(&after);
+	pthread_barrier_destroy(&start);
+
+	return (after.QuadPart - before.QuadPart) * 1e9 / freq.QuadPart /
+			((double)READERS * BENCH_READS);
+}
+
+int main()
+{
+	double seqlock_ns, rwlock_ns;
+	pthread_t writer, readers[READERS];
+	int i;
+
+	for (i = 0; i < READERS; i++) {
+		if (pthread_create(&readers[i], NULL, fn_reader, NULL) != 0) {
+			printf("Error at pthread_create()\n");
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	if (pthread_create(&writer, NULL, fn_writer, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	pthread_join(writer, NULL);
+	for (i = 0; i < READERS; i++)
+		pthread_join(readers[i], NULL);
+
+	if (failed)
+		return PTS_FAIL;
+
+	seqlock_ns = bench(1);
+	rwlock_ns = bench(0);
+	if (failed) {
+		printf("Test FAILED: torn snapshot while timing reads\n");
+		return PTS_FAIL;
+	}
+
+	printf("%d readers, one write per %d reads: %.1f ns per read with "
+			"the seqlock, %.1f ns with a rwlock\n", READERS, WRITE_EVERY,
+			seqlock_ns, rwlock_ns);
+
+	if (pthread_seqlock_destroy_np(&seqlock) != 0) {
+		printf("Error at pthread_seqlock_destroy_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_setaffinity_np(pthread_t thread, size_t cpusetsize,
+ *                                  const cpu_set_t *cpuset)
+ *
+ *	and pthread_attr_setaffinity_np() restrict threads to the given CPUs,
+ *	the attribute from before the thread first runs.
+ *
+ * Steps:
+ * 1.  A set naming a CPU that does not exist should get EINVAL.
+ * 2.  Create a thread with an attr holding only CPU 0. The thread should
+ *     run on CPU 0 from its first instruction, and
+ *     pthread_getaffinity_np() should report only CPU 0.
+ * 3.  Main thread saves its affinity, pins itself to CPU 0 and checks
+ *     pthread_getaffinity_np(), then restores the saved affinity.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+static int on_cpu0(void)
+{
+	PROCESSOR_NUMBER number;
+
+	GetCurrentProcessorNumberEx(&number);
+	return number.Group == 0 && number.Number == 0;
+}
+
+static int only_cpu0(pthread_t thread)
+{
+	cpu_set_t set;
+
+	if (pthread_getaffinity_np(thread, sizeof(set), &set) != 0)
+		return 0;
+
+	return CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set);
+}
+
+static void* fn_chld(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		if (!on_cpu0())
+			return (void *)PTS_FAIL;
+		Sleep(0);
+	}
+
+	if (!only_cpu0(pthread_self()))
+		return (void *)PTS_FAIL;
+
+	return (void *)PTS_PASS;
+}
+
+int main()
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	cpu_set_t set, saved;
+	void *thread_rc;
+
+	CPU_ZERO(&set);
+	CPU_SET(CPU_SETSIZE - 1, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != EINVAL) {
+		printf("Test FAILED: missing CPU did not get EINVAL\n");
+		return PTS_FAIL;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+
+	if (pthread_attr_init(&attr) != 0 ||
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0) {
+		printf("Error setting up the thread attributes\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_create(&thread, &attr, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_join(thread, &thread_rc) != 0) {
+		printf("Error at pthread_join()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	pthread_attr_destroy(&attr);
+
+	if ((long)thread_rc != PTS_PASS) {
+		printf("Test FAILED: thread ran outside its attr affinity\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) != 0) {
+		printf("Error at pthread_getaffinity_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0 ||
+			!only_cpu0(pthread_self()) || !on_cpu0()) {
+		printf("Test FAILED: main thread was not pinned to CPU 0\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved) != 0) {
+		printf("Error restoring the main thread affinity\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
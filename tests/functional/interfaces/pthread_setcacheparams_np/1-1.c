@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_setcacheparams_np(unsigned int max_threads,
+ *                                     unsigned int idle_ms)
+ *
+ *	makes detached threads reuse parked OS threads, and that a reused
+ *	thread starts with no thread specific values.
+ *
+ * Steps:
+ * 1.  Enable the cache and read the parameters back.
+ * 2.  Create detached threads one after another. Each records its OS
+ *     thread id, checks that 'key' is NULL, then sets it.
+ * 3.  At least one thread should have run on the OS thread of the
+ *     previous one, and no thread should have seen a value in 'key'.
+ * 4.  With the cache on and then off, time NUM_OF_TIMED creates from
+ *     pthread_create() to the first line of the thread, and NUM_OF_TIMED
+ *     creates back to back, and print the latency and the rate.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define NUM_OF_THREADS 50
+#define NUM_OF_TIMED   200
+
+static pthread_key_t key;
+static HANDLE done;
+static DWORD thread_id;
+static LARGE_INTEGER started;
+static int stale_values = 0;
+
+static void* fn_chld(void *arg)
+{
+	QueryPerformanceCounter(&started);
+	thread_id = GetCurrentThreadId();
+
+	if (pthread_getspecific(key) != NULL)
+		stale_values++;
+
+	pthread_setspecific(key, (void *)1);
+	SetEvent(done);
+	return NULL;
+}
+
+static void create_and_wait(pthread_attr_t *attr)
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, attr, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		exit(PTS_UNRESOLVED);
+	}
+
+	if (WaitForSingleObject(done, 10000) != WAIT_OBJECT_0) {
+		printf("Error: thread did not run\n");
+		exit(PTS_UNRESOLVED);
+	}
+}
+
+static void measure(pthread_attr_t *attr, const char *label)
+{
+	LARGE_INTEGER freq, before, after;
+	LONGLONG latency = 0;
+	int i;
+
+	QueryPerformanceFrequency(&freq);
+
+	/* One at a time, with the previous thread parked if it can be */
+	for (i = 0; i < NUM_OF_TIMED; i++) {
+		QueryPerformanceCounter(&before);
+		create_and_wait(attr);
+		latency += started.QuadPart - before.QuadPart;
+		Sleep(1);
+	}
+
+	QueryPerformanceCounter(&before);
+	for (i = 0; i < NUM_OF_TIMED; i++)
+		create_and_wait(attr);
+	QueryPerformanceCounter(&after);
+
+	printf("%s: %.1f us from create to run, %.0f creates per second\n",
+			label, latency * 1e6 / freq.QuadPart / NUM_OF_TIMED,
+			NUM_OF_TIMED * (double)freq.QuadPart /
+			(after.QuadPart - before.QuadPart));
+}
+
+int main()
+{
+	pthread_attr_t attr;
+	unsigned int max_threads, idle_ms;
+	DWORD last_id = 0;
+	int i, reused = 0;
+
+	if (pthread_setcacheparams_np(4, 10000) != 0) {
+		printf("Test FAILED: pthread_setcacheparams_np() failed\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_getcacheparams_np(&max_threads, &idle_ms) != 0 ||
+			max_threads != 4 || idle_ms != 10000) {
+		printf("Test FAILED: pthread_getcacheparams_np() mismatch\n");
+		return PTS_FAIL;
+	}
+
+	done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!done || pthread_key_create(&key, NULL) != 0 ||
+			pthread_attr_init(&attr) != 0 ||
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0) {
+		printf("Error setting up the test\n");
+		return PTS_UNRESOLVED;
+	}
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		create_and_wait(&attr);
+
+		if (thread_id == last_id)
+			reused++;
+		last_id = thread_id;
+
+		/* Give the thread time to run its cleanup and park */
+		Sleep(10);
+	}
+
+	measure(&attr, "cached");
+	pthread_setcacheparams_np(0, 0);
+	measure(&attr, "uncached");
+
+	if (stale_values != 0) {
+		printf("Test FAILED: %d reused threads saw stale values\n",
+				stale_values);
+		return PTS_FAIL;
+	}
+
+	if (reused == 0) {
+		printf("Test FAILED: no OS thread was reused\n");
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
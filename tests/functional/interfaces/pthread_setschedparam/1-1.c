@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_setschedparam(pthread_t thread, int policy,
+ *                                 const struct sched_param *param)
+ *
+ *	maps the POSIX policies onto Windows thread priorities, and that
+ *	sched_get_priority_min()/sched_get_priority_max() report the range
+ *	each policy accepts.
+ *
+ * Steps:
+ * 1.  SCHED_FIFO should accept 1 to 99, SCHED_OTHER only 0, an unknown
+ *     policy should get -1.
+ * 2.  Create a thread with an explicit SCHED_FIFO priority 99 attr, the
+ *     priority set before the policy. It should run at
+ *     THREAD_PRIORITY_TIME_CRITICAL from the start.
+ * 3.  Priority 100 should get EINVAL.
+ * 4.  Main thread switches itself to SCHED_IDLE, checks
+ *     THREAD_PRIORITY_IDLE and switches back to SCHED_OTHER.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+static void* fn_chld(void *arg)
+{
+	int policy;
+	struct sched_param param;
+
+	if (GetThreadPriority(GetCurrentThread()) != THREAD_PRIORITY_TIME_CRITICAL)
+		return (void *)PTS_FAIL;
+
+	if (pthread_getschedparam(pthread_self(), &policy, &param) != 0 ||
+			policy != SCHED_FIFO || param.sched_priority != 99)
+		return (void *)PTS_FAIL;
+
+	return (void *)PTS_PASS;
+}
+
+int main()
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	struct sched_param param;
+	void *thread_rc;
+
+	if (sched_get_priority_min(SCHED_FIFO) != 1 ||
+			sched_get_priority_max(SCHED_FIFO) != 99 ||
+			sched_get_priority_min(SCHED_OTHER) != 0 ||
+			sched_get_priority_max(SCHED_OTHER) != 0) {
+		printf("Test FAILED: unexpected priority range\n");
+		return PTS_FAIL;
+	}
+
+	if (sched_get_priority_max(-1) != -1) {
+		printf("Test FAILED: unknown policy did not get -1\n");
+		return PTS_FAIL;
+	}
+
+	param.sched_priority = 99;
+	if (pthread_attr_init(&attr) != 0 ||
+			pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) != 0 ||
+			pthread_attr_setschedparam(&attr, &param) != 0 ||
+			pthread_attr_setschedpolicy(&attr, SCHED_FIFO) != 0) {
+		printf("Error setting up the thread attributes\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_create(&thread, &attr, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_join(thread, &thread_rc) != 0) {
+		printf("Error at pthread_join()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if ((long)thread_rc != PTS_PASS) {
+		printf("Test FAILED: thread did not run at SCHED_FIFO 99\n");
+		return PTS_FAIL;
+	}
+
+	param.sched_priority = 100;
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != EINVAL) {
+		printf("Test FAILED: priority 100 did not get EINVAL\n");
+		return PTS_FAIL;
+	}
+
+	param.sched_priority = 0;
+	if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0 ||
+			GetThreadPriority(GetCurrentThread()) != THREAD_PRIORITY_IDLE) {
+		printf("Test FAILED: SCHED_IDLE was not applied\n");
+		return PTS_FAIL;
+	}
+
+	if (pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) != 0 ||
+			GetThreadPriority(GetCurrentThread()) != THREAD_PRIORITY_NORMAL) {
+		printf("Error restoring SCHED_OTHER\n");
+		return PTS_UNRESOLVED;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
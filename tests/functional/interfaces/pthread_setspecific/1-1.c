@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_setspecific(pthread_key_t key, const void *value)
+ *
+ *	called from a key destructor at thread exit gets the value destroyed
+ *	in a further pass, for at most PTHREAD_DESTRUCTOR_ITERATIONS passes.
+ *
+ * Steps:
+ * 1.  Create 'once_key' whose destructor sets the value again the first
+ *     time it is called, and 'always_key' whose destructor always does.
+ * 2.  A child thread sets both keys and exits.
+ * 3.  The 'once_key' destructor should be called twice, the 'always_key'
+ *     destructor PTHREAD_DESTRUCTOR_ITERATIONS times.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+static pthread_key_t once_key, always_key;
+static int once_calls = 0, always_calls = 0;
+
+static void once_destructor(void *value)
+{
+	if (++once_calls == 1)
+		pthread_setspecific(once_key, value);
+}
+
+static void always_destructor(void *value)
+{
+	always_calls++;
+	pthread_setspecific(always_key, value);
+}
+
+static void* fn_chld(void *arg)
+{
+	pthread_setspecific(once_key, (void *)1);
+	pthread_setspecific(always_key, (void *)1);
+	return NULL;
+}
+
+int main()
+{
+	pthread_t thread;
+
+	if (pthread_key_create(&once_key, once_destructor) != 0 ||
+			pthread_key_create(&always_key, always_destructor) != 0) {
+		printf("Error at pthread_key_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_create(&thread, NULL, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_join(thread, NULL) != 0) {
+		printf("Error at pthread_join()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (once_calls != 2) {
+		printf("Test FAILED: once destructor called %d times, expected 2\n",
+				once_calls);
+		return PTS_FAIL;
+	}
+
+	if (always_calls != PTHREAD_DESTRUCTOR_ITERATIONS) {
+		printf("Test FAILED: always destructor called %d times, expected %d\n",
+				always_calls, PTHREAD_DESTRUCTOR_ITERATIONS);
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
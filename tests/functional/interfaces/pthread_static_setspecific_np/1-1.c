@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_static_setspecific_np(key, value)
+ *
+ *	stores a per-thread value for a key declared with
+ *	PTHREAD_STATIC_KEY_NP(), and that the key destructor is called with
+ *	that value when the thread exits.
+ *
+ * Steps:
+ * 1.  Main thread sets 'key' to a value.
+ * 2.  A child thread checks that its own value is NULL, sets 'key' to
+ *     another value, reads it back and exits.
+ * 3.  The destructor should have been called once, with the child's value.
+ * 4.  Main thread's value should be unchanged.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "posixtest.h"
+
+#define MAIN_VALUE  ((void *)1)
+#define CHILD_VALUE ((void *)2)
+
+static int destructor_calls = 0;
+static void *destructor_value = NULL;
+
+static void destructor(void *value)
+{
+	destructor_calls++;
+	destructor_value = value;
+}
+
+PTHREAD_STATIC_KEY_NP(key, destructor);
+
+static void* fn_chld(void *arg)
+{
+	if (pthread_static_getspecific_np(key) != NULL)
+		return (void *)PTS_FAIL;
+
+	if (pthread_static_setspecific_np(key, CHILD_VALUE) != 0)
+		return (void *)PTS_UNRESOLVED;
+
+	if (pthread_static_getspecific_np(key) != CHILD_VALUE)
+		return (void *)PTS_FAIL;
+
+	return (void *)PTS_PASS;
+}
+
+int main()
+{
+	pthread_t thread;
+	void *thread_rc;
+
+	if (pthread_static_setspecific_np(key, MAIN_VALUE) != 0) {
+		printf("Error at pthread_static_setspecific_np()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_create(&thread, NULL, fn_chld, NULL) != 0) {
+		printf("Error at pthread_create()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if (pthread_join(thread, &thread_rc) != 0) {
+		printf("Error at pthread_join()\n");
+		return PTS_UNRESOLVED;
+	}
+
+	if ((long)thread_rc != PTS_PASS) {
+		printf("Test FAILED: child thread value check failed\n");
+		return PTS_FAIL;
+	}
+
+	if (destructor_calls != 1 || destructor_value != CHILD_VALUE) {
+		printf("Test FAILED: destructor called %d times with %p\n",
+				destructor_calls, destructor_value);
+		return PTS_FAIL;
+	}
+
+	if (pthread_static_getspecific_np(key) != MAIN_VALUE) {
+		printf("Test FAILED: main thread value changed\n");
+		return PTS_FAIL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2017-2018 iwhisper.io
+ * This file is licensed under the GPL license.  For the full content
+ * of this license, see the COPYING file at the top level of this
+ * source tree.
+ *
+ * Test that pthread_timedjoin_np(pthread_t thread, void **value_ptr,
+ *                                const struct timespec *abstime)
+ *
+ *	gives up with ETIMEDOUT while the thread runs, and that
+ *	pthread_tryjoin_np() and pthread_join_any_np() reap exited threads
+ *	without waiting for the others.
+ *
+ * Steps:
+ * 1.  Create NUM_OF_THREADS threads, each waiting on an event of its own
+ *     before returning its index.
+ * 2.  pthread_tryjoin_np() should get EBUSY and pthread_timedjoin_np()
+ *     with a deadline 100ms ahead ETIMEDOUT.
+ * 3.  Release the threads one at a time in reverse order.
+ *     pthread_join_any_np() should return the released thread each time.
+ */
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "posixtest.h"
+
+#define NUM_OF_THREADS 8
+
+static HANDLE events[NUM_OF_THREADS];
+
+static void* fn_chld(void *arg)
+{
+	WaitForSingleObject(events[(long)arg], INFINITE);
+	return arg;
+}
+
+int main()
+{
+	pthread_t threads[NUM_OF_THREADS];
+	struct timeval now;
+	struct timespec abstime;
+	unsigned int index;
+	void *value;
+	long i;
+
+	for (i = 0; i < NUM_OF_THREADS; i++) {
+		events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!events[i] ||
+				pthread_create(&threads[i], NULL, fn_chld, (void *)i) != 0) {
+			printf("Error creating thread %ld\n", i);
+			return PTS_UNRESOLVED;
+		}
+	}
+
+	if (pthread_tryjoin_np(threads[0], &value) != EBUSY) {
+		printf("Test FAILED: pthread_tryjoin_np() did not get EBUSY\n");
+		return PTS_FAIL;
+	}
+
+	gettimeofday(&now, NULL);
+	abstime.tv_sec = now.tv_sec;
+	abstime.tv_nsec = (now.tv_usec + 100 * 1000) * 1000;
+	if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000 * 1000 * 1000;
+	}
+
+	if (pthread_timedjoin_np(threads[0], &value, &abstime) != ETIMEDOUT) {
+		printf("Test FAILED: pthread_timedjoin_np() did not time out\n");
+		return PTS_FAIL;
+	}
+
+	for (i = NUM_OF_THREADS - 1; i >= 0; i--) {
+		SetEvent(events[i]);
+
+		if (pthread_join_any_np(threads, NUM_OF_THREADS, &index,
+				&value, NULL) != 0) {
+			printf("Error at pthread_join_any_np()\n");
+			return PTS_UNRESOLVED;
+		}
+
+		if (index != (unsigned int)i || (long)value != i) {
+			printf("Test FAILED: released %ld, joined %u\n", i, index);
+			return PTS_FAIL;
+		}
+
+		threads[index] = NULL;
+	}
+
+	printf("Test PASSED\n");
+	return PTS_PASS;
+}